@@ -0,0 +1,47 @@
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include <malloc.h>
+
+#include "allocation_counter.h"
+
+namespace {
+
+std::atomic<size_t> _allocations{0};
+std::atomic<int64_t> _bytes_in_use{0};
+
+}  // namespace
+
+allocation_counter::allocation_counter()
+    : m_allocations_at_start(_allocations.load(std::memory_order_relaxed)),
+      m_bytes_at_start(_bytes_in_use.load(std::memory_order_relaxed)) {}
+
+size_t allocation_counter::allocations() const {
+    return _allocations.load(std::memory_order_relaxed) - m_allocations_at_start;
+}
+
+int64_t allocation_counter::bytes_in_use() const {
+    return _bytes_in_use.load(std::memory_order_relaxed) - m_bytes_at_start;
+}
+
+void *operator new(size_t size) {
+    _allocations.fetch_add(1, std::memory_order_relaxed);
+
+    if (void *memory = std::malloc(size ? size : 1)) {
+        _bytes_in_use.fetch_add(malloc_usable_size(memory), std::memory_order_relaxed);
+        return memory;
+    }
+
+    throw std::bad_alloc{};
+}
+
+void operator delete(void *memory) noexcept {
+    if (memory) {
+        _bytes_in_use.fetch_sub(malloc_usable_size(memory), std::memory_order_relaxed);
+    }
+
+    std::free(memory);
+}
+
+void operator delete(void *memory, size_t) noexcept { operator delete(memory); }
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Counts the calls to the global operator new of the whole benchmark executable
+class allocation_counter final {
+   public:
+    allocation_counter();
+
+    size_t allocations() const;
+    // Change of the memory held by operator new since construction, including the overhead of the allocator
+    int64_t bytes_in_use() const;
+
+   private:
+    size_t m_allocations_at_start = 0;
+    int64_t m_bytes_at_start = 0;
+};
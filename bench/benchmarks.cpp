@@ -0,0 +1,540 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <thread>
+
+#include <benchmark/benchmark.h>
+
+#include "allocation_counter.h"
+#include "batch_io.h"
+#include "change_journal.h"
+#include "compilation_database.h"
+#include "damnflags.h"
+#include "file_kind.h"
+#include "logger.h"
+#include "path_table.h"
+#include "synthetic_project.h"
+#include "utils.h"
+#include "workspace.h"
+
+namespace {
+
+// The engine reports a lot of progress on std::cout, which would drown the benchmark output
+class silence_stdout final {
+   public:
+    silence_stdout() : m_old_buffer(std::cout.rdbuf(m_sink.rdbuf())) {}
+    ~silence_stdout() { std::cout.rdbuf(m_old_buffer); }
+
+   private:
+    std::ostringstream m_sink;
+    std::streambuf *m_old_buffer = nullptr;
+};
+
+const synthetic_project &project_with_sources(size_t num_sources) {
+    static std::map<size_t, std::unique_ptr<synthetic_project>> _projects;
+
+    auto result = _projects.find(num_sources);
+
+    if (result != _projects.cend()) {
+        return *result->second;
+    }
+
+    auto options = synthetic_project_options{}
+                       .source_files(num_sources)
+                       .header_files(num_sources / 2)
+                       .unmatched_header_files(num_sources / 10)
+                       .directory_depth(3)
+                       .directories_per_level(4)
+                       .flag_variants(8);
+
+    auto project = synthetic_project::generate(options);
+
+    if (!project) {
+        std::cerr << "Couldn't generate synthetic project with " << num_sources << " sources" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    auto inserted = _projects.emplace(num_sources, std::make_unique<synthetic_project>(std::move(*project)));
+    return *inserted.first->second;
+}
+
+void add_project_sizes(benchmark::internal::Benchmark *benchmark) {
+    benchmark->Arg(500)->Arg(2000)->Arg(8000)->Unit(benchmark::kMillisecond);
+}
+
+// The classification before the generated lookup, allocates the extension and compares it with every candidate
+file_kind classify_file_by_search(const fs::path &path) {
+    static const std::array<std::string, 8> sources{".c", ".cc", ".cpp", ".cxx", ".c++", ".cu", ".m", ".mm"};
+    static const std::array<std::string, 10> headers{".h",   ".hh",  ".hpp", ".hxx", ".h++",
+                                                     ".cuh", ".ipp", ".inl", ".tpp", ".tcc"};
+
+    if (!path.has_extension()) {
+        return file_kind::other;
+    }
+
+    const auto extension = path.extension().string();
+
+    if (std::find(sources.cbegin(), sources.cend(), extension) != sources.cend()) {
+        return file_kind::source;
+    }
+
+    if (std::find(headers.cbegin(), headers.cend(), extension) != headers.cend()) {
+        return file_kind::header;
+    }
+
+    return file_kind::other;
+}
+
+// Processes events until none arrived for a while, the setup of a benchmark can't know how many events it caused
+void process_all_events(workspace &structure) {
+    while (structure.check_for_updates(std::chrono::milliseconds(50))) {
+    }
+}
+
+}  // namespace
+
+static void BM_read_from(benchmark::State &state) {
+    const auto &project = project_with_sources(state.range(0));
+    const auto path = project.compilation_database_path();
+
+    for (auto _ : state) {
+        auto database = compilation_database::read_from(path);
+        benchmark::DoNotOptimize(database);
+    }
+
+    state.SetBytesProcessed(state.iterations() * fs::file_size(path));
+}
+BENCHMARK(BM_read_from)->Apply(add_project_sizes);
+
+static void BM_add_missing_files(benchmark::State &state) {
+    const auto &project = project_with_sources(state.range(0));
+    const auto original = compilation_database::read_from(project.compilation_database_path());
+    const auto relevant_files = project.relevant_files();
+    const auto conf = project.create_config();
+    silence_stdout silence;
+
+    size_t allocations = 0;
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto database = original;
+        state.ResumeTiming();
+
+        allocation_counter counter;
+        bool added_files = database->add_missing_files(relevant_files, conf);
+        allocations += counter.allocations();
+        benchmark::DoNotOptimize(added_files);
+    }
+
+    state.counters["headers"] = project.header_files().size();
+    // Includes the allocations of the created entries themselves, which end up in the database
+    state.counters["allocations_per_header"] =
+        static_cast<double>(allocations) / (state.iterations() * project.header_files().size());
+}
+BENCHMARK(BM_add_missing_files)->Apply(add_project_sizes);
+
+static void BM_split_command(benchmark::State &state) {
+    const auto &project = project_with_sources(500);
+    const auto &commands = project.commands();
+    size_t index = 0;
+
+    for (auto _ : state) {
+        auto parts = split_command(commands[index++ % commands.size()]);
+        benchmark::DoNotOptimize(parts);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_split_command);
+
+static void BM_is_relevant_file(benchmark::State &state) {
+    const auto &project = project_with_sources(500);
+    const auto conf = project.create_config();
+    const auto &headers = project.header_files();
+    silence_stdout silence;
+    size_t index = 0;
+
+    for (auto _ : state) {
+        bool relevant = workspace::is_relevant_file(headers[index++ % headers.size()], conf);
+        benchmark::DoNotOptimize(relevant);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_is_relevant_file);
+
+// 0 = search over the extension of fs::path, 1 = generated lookup on the string
+static void BM_classify_file(benchmark::State &state) {
+    const auto &project = project_with_sources(500);
+    std::vector<fs::path> paths;
+
+    for (size_t i = 0; i < 256; ++i) {
+        const auto &header = project.header_files()[i % project.header_files().size()];
+        const auto &source = project.source_files()[i % project.source_files().size()];
+
+        paths.emplace_back(i % 3 == 0 ? header : source);
+        paths.emplace_back(i % 2 == 0 ? header.parent_path() : fs::path(source).replace_extension(".o"));
+    }
+
+    const bool use_lookup = state.range(0) == 1;
+    size_t index = 0;
+
+    for (auto _ : state) {
+        const auto &path = paths[index++ % paths.size()];
+        auto kind = use_lookup ? classify_file(path.native()) : classify_file_by_search(path);
+        benchmark::DoNotOptimize(kind);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_classify_file)->Arg(0)->Arg(1);
+
+// Memory of the relevant files of a workspace, 0 = std::set<fs::path>, 1 = interned paths in a path_table
+static void BM_relevant_files_memory(benchmark::State &state) {
+    const auto &project = project_with_sources(state.range(0));
+    const auto relevant_files = project.relevant_files();
+    const bool use_table = state.range(1) == 1;
+    int64_t bytes_in_use = 0;
+
+    for (auto _ : state) {
+        allocation_counter counter;
+
+        if (use_table) {
+            path_table paths;
+            path_id_set relevant_ids;
+
+            for (const auto &current_file : relevant_files) {
+                relevant_ids.insert(paths.intern(current_file.native()));
+            }
+
+            bytes_in_use = counter.bytes_in_use();
+            benchmark::DoNotOptimize(relevant_ids);
+        } else {
+            std::set<fs::path> relevant_paths;
+
+            for (const auto &current_file : relevant_files) {
+                relevant_paths.emplace(current_file);
+            }
+
+            bytes_in_use = counter.bytes_in_use();
+            benchmark::DoNotOptimize(relevant_paths);
+        }
+    }
+
+    state.counters["bytes_per_file"] = static_cast<double>(bytes_in_use) / relevant_files.size();
+}
+BENCHMARK(BM_relevant_files_memory)->Args({8000, 0})->Args({8000, 1})->Unit(benchmark::kMillisecond);
+
+// Resolves the path of an event for a known file, like the inotify handler does
+static void BM_path_lookup(benchmark::State &state) {
+    const auto &project = project_with_sources(2000);
+    path_table paths;
+    std::vector<std::pair<path_id, std::string>> events;
+
+    for (const auto &current_file : project.relevant_files()) {
+        paths.intern(current_file.native());
+        events.emplace_back(paths.find(current_file.parent_path().native()), current_file.filename().string());
+    }
+
+    std::string buffer;
+    size_t index = 0;
+    allocation_counter counter;
+
+    for (auto _ : state) {
+        const auto &[directory_id, name] = events[index++ % events.size()];
+        paths.write_path(paths.find(directory_id, name), buffer);
+        benchmark::DoNotOptimize(buffer.data());
+    }
+
+    state.counters["allocations"] = counter.allocations();
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_path_lookup);
+
+static void BM_write_to(benchmark::State &state) {
+    const auto &project = project_with_sources(state.range(0));
+    auto database = compilation_database::read_from(project.compilation_database_path());
+    const auto output = project.root() / "bench_output.json";
+
+    {
+        silence_stdout silence;
+        database->add_missing_files(project.relevant_files(), project.create_config());
+    }
+
+    for (auto _ : state) {
+        bool written = database->write_to(output);
+        benchmark::DoNotOptimize(written);
+    }
+
+    state.SetBytesProcessed(state.iterations() * fs::file_size(output));
+}
+BENCHMARK(BM_write_to)->Apply(add_project_sizes);
+
+// Measures the time from creating a new header until the updated compilation database has been written
+static void BM_event_to_write_latency(benchmark::State &state) {
+    const auto &project = project_with_sources(state.range(0));
+    silence_stdout silence;
+    auto structure = workspace::discover_project(project.root(), project.create_config());
+
+    if (!structure) {
+        state.SkipWithError("Couldn't discover the synthetic project");
+        return;
+    }
+
+    const auto output = structure->project_root() / compilation_database::database_name;
+    const auto header_directory = project.header_files().front().parent_path();
+    size_t header_index = 0;
+
+    for (auto _ : state) {
+        auto header = header_directory / ("latency_" + std::to_string(header_index++) + ".h");
+        std::ofstream(header) << "#pragma once\n";
+
+        structure->check_for_updates();
+
+        state.PauseTiming();
+        if (!fs::exists(output)) {
+            state.SkipWithError("The compilation database wasn't written");
+            break;
+        }
+        fs::remove(header);
+        structure->check_for_updates();
+        state.ResumeTiming();
+    }
+}
+BENCHMARK(BM_event_to_write_latency)->Apply(add_project_sizes)->Iterations(10);
+
+// Measures handling the events of deleting a directory with range(0) headers, the deletion itself isn't measured
+static void BM_remove_directory(benchmark::State &state) {
+    const auto &project = project_with_sources(500);
+    silence_stdout silence;
+    auto structure = workspace::discover_project(project.root(), project.create_config());
+
+    if (!structure) {
+        state.SkipWithError("Couldn't discover the synthetic project");
+        return;
+    }
+
+    const auto directory = project.header_files().front().parent_path() / "removed";
+    constexpr size_t num_subdirectories = 10;
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        fs::create_directories(directory);
+        process_all_events(*structure);
+
+        for (size_t i = 0; i < num_subdirectories; ++i) {
+            fs::create_directories(directory / std::to_string(i));
+        }
+        process_all_events(*structure);
+
+        for (size_t i = 0; i < static_cast<size_t>(state.range(0)); ++i) {
+            std::ofstream(directory / std::to_string(i % num_subdirectories) / ("removed_" + std::to_string(i) + ".h"));
+        }
+        process_all_events(*structure);
+
+        // Gives the reader thread the time to queue all events of the deletion
+        fs::remove_all(directory);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        state.ResumeTiming();
+
+        structure->check_for_updates(std::chrono::milliseconds(0));
+    }
+}
+BENCHMARK(BM_remove_directory)->Arg(1000)->Arg(10000)->Unit(benchmark::kMillisecond)->Iterations(3);
+
+// Measures handling a moved directory with range(0) headers, range(1) = 0 moves it within the project, which renames
+// it in place, 1 moves it in from outside of the project, which has to scan it
+static void BM_move_directory(benchmark::State &state) {
+    const auto &project = project_with_sources(500);
+    silence_stdout silence;
+    auto structure = workspace::discover_project(project.root(), project.create_config());
+
+    if (!structure) {
+        state.SkipWithError("Couldn't discover the synthetic project");
+        return;
+    }
+
+    const auto header_directory = project.header_files().front().parent_path();
+    const auto outside = project.root().parent_path() / (project.root().filename().string() + "_outside");
+    const auto source = state.range(1) == 0 ? header_directory / "moved_from" : outside;
+    const auto destination = header_directory / "moved_to";
+    constexpr size_t num_subdirectories = 10;
+
+    fs::remove_all(outside);
+    fs::create_directories(source);
+    process_all_events(*structure);
+
+    for (size_t i = 0; i < num_subdirectories; ++i) {
+        fs::create_directories(source / std::to_string(i));
+    }
+    process_all_events(*structure);
+
+    for (size_t i = 0; i < static_cast<size_t>(state.range(0)); ++i) {
+        std::ofstream(source / std::to_string(i % num_subdirectories) / ("moved_" + std::to_string(i) + ".h"));
+    }
+    process_all_events(*structure);
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        fs::rename(source, destination);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        state.ResumeTiming();
+
+        structure->check_for_updates(std::chrono::milliseconds(0));
+
+        state.PauseTiming();
+        fs::rename(destination, source);
+        process_all_events(*structure);
+        state.ResumeTiming();
+    }
+
+    fs::remove_all(outside);
+}
+BENCHMARK(BM_move_directory)
+    ->Args({10000, 0})
+    ->Args({10000, 1})
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(3);
+
+// Size and parse time of the generated output, 0 = plain, 1 = canonicalized flags, 2 = canonicalized and compact
+static void BM_output_format(benchmark::State &state) {
+    const auto &project = project_with_sources(state.range(0));
+    const auto output = project.root() / "bench_format.json";
+    auto conf = project.create_config().canonicalize_flags(state.range(1) >= 1).compact_output(state.range(1) >= 2);
+    auto database = compilation_database::read_from(project.compilation_database_path());
+
+    {
+        silence_stdout silence;
+        database->add_missing_files(project.relevant_files(), conf);
+    }
+
+    if (conf.compact_output()) {
+        database->share_flag_sets(project.root() / compilation_database::flag_set_directory_name);
+    }
+
+    database->write_to(output);
+
+    for (auto _ : state) {
+        auto parsed = compilation_database::read_from(output);
+        benchmark::DoNotOptimize(parsed);
+    }
+
+    state.counters["output_bytes"] = fs::file_size(output);
+}
+BENCHMARK(BM_output_format)
+    ->Args({8000, 0})
+    ->Args({8000, 1})
+    ->Args({8000, 2})
+    ->Unit(benchmark::kMillisecond);
+
+static void BM_generate_compilation_database(benchmark::State &state) {
+    const auto &project = project_with_sources(state.range(0));
+    const auto conf = project.create_config();
+    silence_stdout silence;
+
+    for (auto _ : state) {
+        auto result = generate_compilation_database(project.root(), conf, state.range(1));
+        benchmark::DoNotOptimize(result);
+    }
+}
+BENCHMARK(BM_generate_compilation_database)
+    ->Args({2000, 1})
+    ->Args({2000, 0})
+    ->Args({8000, 1})
+    ->Args({8000, 0})
+    ->Unit(benchmark::kMillisecond);
+
+// Stats or reads every file of the project, 0 = one after the other, 1 = io_uring. On a local disk the difference is
+// mostly the syscalls, on a network file system the requests of a batch also wait for their round trips together.
+static void BM_batch_io(benchmark::State &state) {
+    const auto &project = project_with_sources(state.range(0));
+    const bool read_contents = state.range(1) == 1;
+    batch_io io(state.range(2) == 1);
+    std::vector<std::string> paths;
+
+    if (state.range(2) == 1 && !io.uses_io_uring()) {
+        state.SkipWithError("io_uring isn't available");
+        return;
+    }
+
+    for (const auto &current_file : project.relevant_files()) {
+        paths.emplace_back(current_file.string());
+    }
+
+    for (auto _ : state) {
+        if (read_contents) {
+            auto contents = io.read(paths);
+            benchmark::DoNotOptimize(contents);
+        } else {
+            auto statuses = io.stat(paths);
+            benchmark::DoNotOptimize(statuses);
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * paths.size());
+    state.counters["syscalls_per_file"] = static_cast<double>(io.statistics().syscalls) / io.statistics().requests;
+}
+BENCHMARK(BM_batch_io)
+    ->Args({8000, 0, 0})
+    ->Args({8000, 0, 1})
+    ->Args({8000, 1, 0})
+    ->Args({8000, 1, 1})
+    ->Unit(benchmark::kMillisecond);
+
+// The scan of the whole tree, which only has to stat what the directory listings don't tell
+static void BM_batch_walk(benchmark::State &state) {
+    const auto &project = project_with_sources(state.range(0));
+    batch_io io(state.range(1) == 1);
+    size_t num_entries = 0;
+
+    for (auto _ : state) {
+        io.walk(project.root(), [&num_entries](const std::string &, bool, bool) { ++num_entries; });
+    }
+
+    benchmark::DoNotOptimize(num_entries);
+    state.counters["syscalls"] = benchmark::Counter(io.statistics().syscalls, benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_batch_walk)->Args({8000, 0})->Args({8000, 1})->Unit(benchmark::kMillisecond);
+
+// What the change journal adds to every write of the database, when one entry changed each time
+static void BM_change_journal(benchmark::State &state) {
+    const auto &project = project_with_sources(state.range(0));
+    const auto path = project.root() / change_journal::journal_name;
+    auto database = compilation_database::read_from(project.compilation_database_path())->database();
+    fs::remove(path);
+    auto journal = change_journal::open(path);
+    journal->record(database);
+    size_t round = 0;
+
+    for (auto _ : state) {
+        database[round % database.size()]["command"] = "g++ -DROUND=" + std::to_string(round) + " -c file.cpp";
+        ++round;
+        journal->record(database);
+    }
+
+    state.counters["records"] = journal->num_records();
+    state.counters["journal_bytes"] = fs::file_size(path);
+    fs::remove(path);
+}
+BENCHMARK(BM_change_journal)->Apply(add_project_sizes);
+
+int main(int argc, char *argv[]) {
+    logger_configuration log_config;
+    log_config.should_log_to_console(false);
+    logger::instance(log_config);
+
+    benchmark::Initialize(&argc, argv);
+
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return EXIT_FAILURE;
+    }
+
+    benchmark::RunSpecifiedBenchmarks();
+    return EXIT_SUCCESS;
+}
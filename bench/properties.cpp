@@ -0,0 +1,121 @@
+#include <fstream>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <unistd.h>
+
+#include <benchmark/benchmark.h>
+#include <nlohmann/json.hpp>
+
+#include "compilation_database.h"
+#include "random_inputs.h"
+#include "utils.h"
+
+// The throughput of the functions which test/properties.cpp checks against their references, on the same random
+// inputs
+
+static void BM_property_split_command(benchmark::State &state) {
+    auto engine = random_engine();
+    std::vector<std::string> commands;
+    size_t bytes = 0;
+
+    for (auto i = state.range(0); i > 0; --i) {
+        commands.emplace_back(random_command(engine));
+        bytes += commands.back().size();
+    }
+
+    std::pmr::monotonic_buffer_resource arena;
+    std::pmr::vector<std::string_view> parts(&arena);
+
+    for (auto _ : state) {
+        for (const auto &current_command : commands) {
+            parts.clear();
+            split_command(current_command, parts);
+            benchmark::DoNotOptimize(parts.data());
+        }
+    }
+
+    state.SetBytesProcessed(state.iterations() * bytes);
+}
+BENCHMARK(BM_property_split_command)->Arg(10000);
+
+static void BM_property_remove_specific_flags(benchmark::State &state) {
+    auto engine = random_engine();
+    std::vector<std::string> commands;
+
+    for (auto i = state.range(0); i > 0; --i) {
+        commands.emplace_back(random_command(engine));
+    }
+
+    std::pmr::monotonic_buffer_resource arena;
+    std::vector<std::pmr::vector<std::string_view>> split_commands;
+
+    for (const auto &current_command : commands) {
+        split_command(current_command, split_commands.emplace_back(&arena));
+    }
+
+    std::pmr::vector<std::string_view> filtered(&arena);
+
+    for (auto _ : state) {
+        for (const auto &current_command : split_commands) {
+            filtered.assign(current_command.cbegin(), current_command.cend());
+            remove_specific_flags(filtered);
+            benchmark::DoNotOptimize(filtered.data());
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * split_commands.size());
+}
+BENCHMARK(BM_property_remove_specific_flags)->Arg(10000);
+
+static void BM_property_replace_pattern_with(benchmark::State &state) {
+    auto engine = random_engine();
+    std::vector<std::pair<std::string, std::string_view>> cases;
+
+    for (auto i = state.range(0); i > 0; --i) {
+        cases.emplace_back(random_pattern(engine));
+    }
+
+    std::string replaced;
+
+    for (auto _ : state) {
+        for (const auto &[pattern, to_replace] : cases) {
+            replaced = pattern;
+            replace_pattern_with(replaced, to_replace, "/root");
+            benchmark::DoNotOptimize(replaced.data());
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * cases.size());
+}
+BENCHMARK(BM_property_replace_pattern_with)->Arg(10000);
+
+static void BM_property_serialize(benchmark::State &state) {
+    auto engine = random_engine();
+    const auto path = fs::temp_directory_path() / ("damnflags_property_" + std::to_string(getpid()) + ".json");
+    std::vector<compilation_database> databases;
+    size_t bytes = 0;
+
+    for (auto i = state.range(0); i > 0; --i) {
+        std::ofstream(path, std::ios::binary) << random_database(engine).dump(i % 2 == 0 ? -1 : 4);
+
+        if (auto database = compilation_database::read_from(path)) {
+            bytes += database->serialize().size();
+            databases.emplace_back(std::move(*database));
+        }
+    }
+
+    fs::remove(path);
+
+    for (auto _ : state) {
+        for (const auto &current_database : databases) {
+            auto serialized = current_database.serialize();
+            benchmark::DoNotOptimize(serialized.data());
+        }
+    }
+
+    state.SetBytesProcessed(state.iterations() * bytes);
+}
+BENCHMARK(BM_property_serialize)->Arg(500);
@@ -0,0 +1,74 @@
+#include <cstdlib>
+#include <vector>
+
+#include "random_inputs.h"
+
+std::mt19937_64 random_engine() {
+    const char *seed = std::getenv("DAMNFLAGS_PROPERTY_SEED");
+    return std::mt19937_64(seed ? std::strtoull(seed, nullptr, 10) : 0x5eedu);
+}
+
+std::string random_string(std::mt19937_64 &engine, std::string_view alphabet, size_t max_length) {
+    std::uniform_int_distribution<size_t> length(0, max_length);
+    std::uniform_int_distribution<size_t> character(0, alphabet.size() - 1);
+    std::string result(length(engine), '\0');
+
+    for (auto &current_char : result) {
+        current_char = alphabet[character(engine)];
+    }
+
+    return result;
+}
+
+std::string random_command(std::mt19937_64 &engine) {
+    static const std::vector<std::string_view> tokens{
+        "-I",  "include", "-Iinclude", "-o", "main.o", "-c",       "main.cpp", "-DX=1", "-isystem",
+        "/usr/include", "-MF", "dep.d", "-O2", "-W",   "file.h",   "-x",       "c++",   "@flags.rsp",
+        "-include",     "-cx", "-ofile", "--sysroot", "-Xclang", "-target", "-"};
+    static constexpr std::string_view separators[] = {" ", " ", "  ", "\t", "\n", " \t "};
+    std::uniform_int_distribution<size_t> num_tokens(0, 24);
+    std::uniform_int_distribution<size_t> token(0, tokens.size());
+    std::uniform_int_distribution<size_t> separator(0, std::size(separators) - 1);
+    std::string command = random_string(engine, " \t", 2);
+
+    for (size_t i = num_tokens(engine); i > 0; --i) {
+        const size_t chosen = token(engine);
+        // One past the tokens is a random word, which can be anything which isn't whitespace
+        command += chosen < tokens.size() ? std::string(tokens[chosen]) : random_string(engine, "-_=/.aIoc\"'\\", 6);
+        command += separators[separator(engine)];
+    }
+
+    return command;
+}
+
+nlohmann::json random_database(std::mt19937_64 &engine) {
+    std::uniform_int_distribution<size_t> num_entries(0, 32);
+    std::bernoulli_distribution use_arguments(0.3);
+    nlohmann::json database = nlohmann::json::array();
+
+    for (size_t i = num_entries(engine); i > 0; --i) {
+        nlohmann::json entry{{"directory", "/p/" + random_string(engine, "ab/ \"\\", 8)},
+                             {"file", "/p/" + random_string(engine, "ab/.ch\t\"\\", 12)}};
+
+        if (use_arguments(engine)) {
+            entry["arguments"] = nlohmann::json::array({"g++", random_string(engine, "-Iab \"", 8)});
+        } else {
+            entry["command"] = random_command(engine);
+        }
+
+        database.push_back(std::move(entry));
+    }
+
+    return database;
+}
+
+std::pair<std::string, std::string_view> random_pattern(std::mt19937_64 &engine) {
+    static constexpr std::string_view variables[] = {"${project_root}", "${working_dir}", "$", "{}"};
+    std::uniform_int_distribution<size_t> variable(0, std::size(variables) - 1);
+    const auto chosen = variables[variable(engine)];
+    std::string pattern = random_string(engine, "/ab.*", 6);
+    pattern += chosen.substr(0, std::uniform_int_distribution<size_t>(0, chosen.size())(engine));
+    pattern += random_string(engine, "/x}.*", 6);
+
+    return {std::move(pattern), chosen};
+}
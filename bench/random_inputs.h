@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+#include <random>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include <nlohmann/json.hpp>
+
+// Random inputs shared by the property checks and the benchmarks measuring the same functions. They are the same on
+// every run, unless DAMNFLAGS_PROPERTY_SEED is set.
+
+std::mt19937_64 random_engine();
+
+// Picks from a small alphabet, so separators, prefixes of patterns and special characters come up often
+std::string random_string(std::mt19937_64 &engine, std::string_view alphabet, size_t max_length);
+
+std::string random_command(std::mt19937_64 &engine);
+
+nlohmann::json random_database(std::mt19937_64 &engine);
+
+// A pattern and the variable to replace in it, mostly the variables themselves and prefixes of them, like
+// ${project_rootx, with the rest of a pattern around
+std::pair<std::string, std::string_view> random_pattern(std::mt19937_64 &engine);
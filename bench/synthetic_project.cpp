@@ -0,0 +1,226 @@
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <sstream>
+
+#include <unistd.h>
+
+#include <nlohmann/json.hpp>
+
+#include "compilation_database.h"
+#include "synthetic_project.h"
+
+synthetic_project_options &synthetic_project_options::source_files(size_t value) {
+    m_source_files = value;
+    return *this;
+}
+
+synthetic_project_options &synthetic_project_options::header_files(size_t value) {
+    m_header_files = value;
+    return *this;
+}
+
+synthetic_project_options &synthetic_project_options::unmatched_header_files(size_t value) {
+    m_unmatched_header_files = value;
+    return *this;
+}
+
+synthetic_project_options &synthetic_project_options::directory_depth(size_t value) {
+    m_directory_depth = value;
+    return *this;
+}
+
+synthetic_project_options &synthetic_project_options::directories_per_level(size_t value) {
+    m_directories_per_level = value;
+    return *this;
+}
+
+synthetic_project_options &synthetic_project_options::flag_variants(size_t value) {
+    m_flag_variants = value;
+    return *this;
+}
+
+size_t synthetic_project_options::source_files() const { return m_source_files; }
+
+size_t synthetic_project_options::header_files() const { return m_header_files; }
+
+size_t synthetic_project_options::unmatched_header_files() const { return m_unmatched_header_files; }
+
+size_t synthetic_project_options::directory_depth() const { return m_directory_depth; }
+
+size_t synthetic_project_options::directories_per_level() const { return m_directories_per_level; }
+
+size_t synthetic_project_options::flag_variants() const { return m_flag_variants; }
+
+namespace {
+
+std::vector<fs::path> create_directory_layout(const synthetic_project_options &options) {
+    std::vector<fs::path> directories{fs::path{}};
+    size_t level_begin = 0;
+
+    for (size_t level = 0; level < options.directory_depth(); ++level) {
+        size_t level_end = directories.size();
+
+        for (size_t parent = level_begin; parent < level_end; ++parent) {
+            for (size_t child = 0; child < options.directories_per_level(); ++child) {
+                directories.emplace_back(directories[parent] / ("d" + std::to_string(child)));
+            }
+        }
+
+        level_begin = level_end;
+    }
+
+    return directories;
+}
+
+bool touch_file(const fs::path &path, const std::string &content) {
+    std::ofstream out(path);
+
+    if (!out) {
+        return false;
+    }
+
+    out << content;
+    return static_cast<bool>(out);
+}
+
+std::string create_command(const fs::path &root, const fs::path &directory, const fs::path &source, size_t variant) {
+    std::ostringstream command;
+
+    command << "/usr/bin/c++ -DVARIANT_" << variant << " -DDAMNFLAGS_BENCH=1";
+    command << " -I" << (root / "include").c_str() << " -I" << (root / "include" / directory).c_str();
+    command << " -isystem /usr/include/variant_" << variant;
+
+    // Every variant gets a slightly different set of warnings and optimizations
+    command << " -O" << (variant % 4) << " -std=c++17 -Wall -Wextra";
+    for (size_t i = 0; i < variant % 5; ++i) {
+        command << " -Wno-unused-" << i;
+    }
+
+    command << " -o CMakeFiles/damnflags_bench.dir/" << source.filename().c_str() << ".o";
+    command << " -c " << source.c_str();
+
+    return command.str();
+}
+
+}  // namespace
+
+synthetic_project::synthetic_project(fs::path root) : m_root(std::move(root)) {}
+
+synthetic_project::synthetic_project(synthetic_project &&other)
+    : m_root(std::move(other.m_root)),
+      m_source_files(std::move(other.m_source_files)),
+      m_header_files(std::move(other.m_header_files)),
+      m_commands(std::move(other.m_commands)) {
+    other.m_root.clear();
+}
+
+synthetic_project::~synthetic_project() {
+    if (m_root.empty()) {
+        return;
+    }
+
+    std::error_code ec;
+    fs::remove_all(m_root, ec);
+}
+
+std::optional<synthetic_project> synthetic_project::generate(const synthetic_project_options &options) {
+    static std::atomic<size_t> _project_counter{0};
+
+    auto root = fs::temp_directory_path() /
+                ("damnflags_bench_" + std::to_string(getpid()) + "_" + std::to_string(_project_counter++));
+
+    std::error_code ec;
+    fs::remove_all(root, ec);
+
+    synthetic_project project(root);
+    const auto directories = create_directory_layout(options);
+
+    for (const auto &current_directory : directories) {
+        fs::create_directories(root / "src" / current_directory, ec);
+        fs::create_directories(root / "include" / current_directory, ec);
+
+        if (ec) {
+            return std::nullopt;
+        }
+    }
+
+    fs::create_directories(root / "build", ec);
+
+    if (ec) {
+        return std::nullopt;
+    }
+
+    nlohmann::json database = nlohmann::json::array();
+    const size_t variants = std::max<size_t>(options.flag_variants(), 1);
+
+    for (size_t i = 0; i < options.source_files(); ++i) {
+        const auto &current_directory = directories[i % directories.size()];
+        auto source = root / "src" / current_directory / ("file_" + std::to_string(i) + ".cpp");
+
+        if (!touch_file(source, "int file_" + std::to_string(i) + "() { return 0; }\n")) {
+            return std::nullopt;
+        }
+
+        auto command = create_command(root, current_directory, source, i % variants);
+
+        database.push_back({{"directory", (root / "build").string()}, {"command", command}, {"file", source.string()}});
+        project.m_source_files.emplace_back(std::move(source));
+        project.m_commands.emplace_back(std::move(command));
+    }
+
+    const size_t matched_headers = std::min(options.header_files(), options.source_files());
+
+    for (size_t i = 0; i < matched_headers + options.unmatched_header_files(); ++i) {
+        const auto &current_directory = directories[i % directories.size()];
+        auto stem = (i < matched_headers ? "file_" : "unmatched_") + std::to_string(i);
+        auto header = root / "include" / current_directory / (stem + ".h");
+
+        if (!touch_file(header, "#pragma once\n")) {
+            return std::nullopt;
+        }
+
+        project.m_header_files.emplace_back(std::move(header));
+    }
+
+    if (!touch_file(project.compilation_database_path(), database.dump())) {
+        return std::nullopt;
+    }
+
+    return project;
+}
+
+const fs::path &synthetic_project::root() const { return m_root; }
+
+fs::path synthetic_project::compilation_database_path() const {
+    return m_root / "build" / compilation_database::database_name;
+}
+
+const std::vector<fs::path> &synthetic_project::source_files() const { return m_source_files; }
+
+const std::vector<fs::path> &synthetic_project::header_files() const { return m_header_files; }
+
+const std::vector<std::string> &synthetic_project::commands() const { return m_commands; }
+
+std::vector<fs::path> synthetic_project::relevant_files() const {
+    std::vector<fs::path> relevant_files(m_source_files.cbegin(), m_source_files.cend());
+    relevant_files.insert(relevant_files.end(), m_header_files.cbegin(), m_header_files.cend());
+    relevant_files.emplace_back(compilation_database_path());
+    std::sort(relevant_files.begin(), relevant_files.end(),
+              [](const auto &lhs, const auto &rhs) { return lhs.native() < rhs.native(); });
+
+    return relevant_files;
+}
+
+config synthetic_project::create_config() const {
+    nlohmann::json conf{
+        {"project_root", m_root.string()},
+        {"get_flags_from", m_source_files.empty() ? std::string{} : m_source_files.front().string()},
+        {"whitelist_patterns",
+         {(m_root / "src").string(), (m_root / "include").string(), compilation_database_path().string()}}};
+
+    auto created_config = config::create_config(conf).value();
+    created_config.compilation_database_path(compilation_database_path());
+
+    return created_config;
+}
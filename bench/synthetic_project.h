@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "config.h"
+#include "filesys.h"
+
+class synthetic_project_options final {
+   public:
+    synthetic_project_options() = default;
+
+    synthetic_project_options &source_files(size_t value);
+    synthetic_project_options &header_files(size_t value);
+    synthetic_project_options &unmatched_header_files(size_t value);
+    synthetic_project_options &directory_depth(size_t value);
+    synthetic_project_options &directories_per_level(size_t value);
+    synthetic_project_options &flag_variants(size_t value);
+
+    size_t source_files() const;
+    size_t header_files() const;
+    size_t unmatched_header_files() const;
+    size_t directory_depth() const;
+    size_t directories_per_level() const;
+    size_t flag_variants() const;
+
+   private:
+    size_t m_source_files = 1000;
+    // Headers with a source file of the same stem
+    size_t m_header_files = 1000;
+    // Headers which have to fall back to the common flags
+    size_t m_unmatched_header_files = 100;
+    size_t m_directory_depth = 3;
+    size_t m_directories_per_level = 4;
+    size_t m_flag_variants = 8;
+};
+
+// Creates a project tree with a compile_commands.json below the temp directory and removes it again on destruction
+class synthetic_project final {
+   public:
+    static std::optional<synthetic_project> generate(const synthetic_project_options &options);
+
+    synthetic_project(const synthetic_project &other) = delete;
+    synthetic_project(synthetic_project &&other);
+    ~synthetic_project();
+
+    synthetic_project &operator=(const synthetic_project &other) = delete;
+    synthetic_project &operator=(synthetic_project &&other) = delete;
+
+    const fs::path &root() const;
+    fs::path compilation_database_path() const;
+    const std::vector<fs::path> &source_files() const;
+    const std::vector<fs::path> &header_files() const;
+    const std::vector<std::string> &commands() const;
+
+    // Sorted like the relevant files of a workspace
+    std::vector<fs::path> relevant_files() const;
+    config create_config() const;
+
+   private:
+    synthetic_project(fs::path root);
+
+    fs::path m_root;
+    std::vector<fs::path> m_source_files;
+    std::vector<fs::path> m_header_files;
+    std::vector<std::string> m_commands;
+};
@@ -24,13 +24,14 @@ class DamnflagsConan(ConanFile):
         cmake.build()
 
     def package(self):
-        self.copy("*.h", dst="include", src="hello")
-        self.copy("*hello.lib", dst="lib", keep_path=False)
+        self.copy("*.h", dst="include/damnflags", src="include")
+        self.copy("*damnflags.lib", dst="lib", keep_path=False)
         self.copy("*.dll", dst="bin", keep_path=False)
         self.copy("*.so", dst="lib", keep_path=False)
         self.copy("*.dylib", dst="lib", keep_path=False)
         self.copy("*.a", dst="lib", keep_path=False)
+        self.copy("damnflags", dst="bin", src="bin", keep_path=False)
 
     def package_info(self):
-        self.cpp_info.libs = ["hello"]
-
+        self.cpp_info.libs = ["damnflags"]
+        self.cpp_info.includedirs = ["include/damnflags"]
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "filesys.h"
+
+struct file_status final {
+    bool is_directory = false;
+    bool is_regular_file = false;
+    uintmax_t size = 0;
+    // Since the epoch, the same for both backends, unlike fs::file_time_type which has its own clock
+    std::chrono::nanoseconds modification_time{};
+};
+
+bool operator==(const file_status &lhs, const file_status &rhs);
+bool operator!=(const file_status &lhs, const file_status &rhs);
+
+struct file_contents final {
+    file_status status;
+    std::string content;
+};
+
+struct io_statistics final {
+    uint64_t requests = 0;
+    // io_uring needs one per batch, the synchronous backend at least one per request
+    uint64_t syscalls = 0;
+};
+
+class io_uring_queue;
+
+// Stats and reads many files at once. With io_uring all requests of a batch go to the kernel with one syscall and run
+// concurrently, which matters on network file systems where every request waits for a round trip. Without it, or if
+// the kernel doesn't support it, the requests are done one after the other. Not thread safe.
+class batch_io final {
+   public:
+    // Requests in flight at once with io_uring, larger batches are split
+    static inline constexpr unsigned int queue_depth = 256;
+
+    // Falls back to the synchronous backend if io_uring isn't available
+    explicit batch_io(bool use_io_uring = false);
+    batch_io(const batch_io &other) = delete;
+    batch_io(batch_io &&other);
+    ~batch_io();
+
+    batch_io &operator=(const batch_io &other) = delete;
+    batch_io &operator=(batch_io &&other);
+
+    // One request each, for single files which don't have to wait for others. Symbolic links are followed.
+    static std::optional<file_status> stat_file(const std::string &path);
+    static std::optional<file_contents> read_file(const std::string &path);
+
+    // Stays false once a batch couldn't be submitted, the requests are done synchronously from then on
+    bool uses_io_uring() const;
+
+    // The results are in the order of paths, nothing for paths which couldn't be stat'd or read
+    std::vector<std::optional<file_status>> stat(const std::vector<std::string> &paths);
+    std::vector<std::optional<file_contents>> read(const std::vector<std::string> &paths);
+
+    // Calls func with everything below root, like fs::recursive_directory_iterator without following links. Only the
+    // entries whose type the directory listing doesn't tell are stat'd, all of them in one batch per level of the tree.
+    void walk(const fs::path &root,
+              const std::function<void(const std::string &path, bool is_directory, bool is_regular_file)> &func);
+
+    io_statistics statistics() const;
+
+   private:
+    std::vector<std::optional<file_status>> stat_synchronously(const std::vector<std::string> &paths);
+    std::vector<std::optional<file_contents>> read_synchronously(const std::vector<std::string> &paths);
+
+    std::unique_ptr<io_uring_queue> m_queue;
+    io_statistics m_statistics;
+};
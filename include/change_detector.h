@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <set>
+#include <string>
+#include <string_view>
+
+#include "filesys.h"
+
+struct file_fingerprint final {
+    uintmax_t size = 0;
+    fs::file_time_type modification_time{};
+    uint64_t content_hash = 0;
+};
+
+// Two fingerprints are the same if the content is, the modification time only decides if the content is hashed again
+bool operator==(const file_fingerprint &lhs, const file_fingerprint &rhs);
+bool operator!=(const file_fingerprint &lhs, const file_fingerprint &rhs);
+
+// Remembers the state the compilation database was last generated from, to skip regenerations and writes which
+// wouldn't change anything
+class change_detector final {
+   public:
+    // Reuses the hash of previous, if size and modification time didn't change
+    static std::optional<file_fingerprint> fingerprint(const fs::path &path,
+                                                       const std::optional<file_fingerprint> &previous = {});
+    static file_fingerprint fingerprint_of_content(std::string_view content);
+
+    // The fingerprint of the relevant files is independent of their order, so it can be updated incrementally
+    void relevant_file_added(std::string_view path);
+    void relevant_file_removed(std::string_view path);
+    void relevant_files_cleared();
+    uint64_t relevant_files_fingerprint() const;
+    // Lazy augmentation only generates entries for a subset of the relevant files, identified by a stable key
+    void working_set_added(uint64_t key);
+    void working_set_removed(uint64_t key);
+
+    // True if neither the relevant files nor the input database changed since generated() was called
+    bool is_up_to_date(const fs::path &input_database);
+    // For inputs which aren't tracked here, like response files, makes the next is_up_to_date return false
+    void input_changed();
+    void generated();
+
+    // False if the file on disk already has exactly this content
+    bool output_changed(const fs::path &output, std::string_view serialized);
+    void output_written(const fs::path &output, std::string_view serialized);
+
+    // Paths which are only written by damnflags itself, events for them are ignored
+    void ignore_path(const fs::path &path);
+    bool is_self_inflicted(std::string_view path) const;
+
+   private:
+    uint64_t m_relevant_files_fingerprint = 0;
+    uint64_t m_working_set_fingerprint = 0;
+    std::optional<file_fingerprint> m_input_fingerprint{};
+    std::optional<uint64_t> m_generated_relevant_files{};
+    std::optional<file_fingerprint> m_generated_input{};
+    fs::path m_output_path{};
+    std::optional<file_fingerprint> m_output_fingerprint{};
+    std::set<std::string, std::less<>> m_ignored_paths{};
+};
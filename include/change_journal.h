@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include <nlohmann/json.hpp>
+
+#include "filesys.h"
+
+enum class journal_operation { add, modify, remove };
+
+// Append-only log of the entry level changes of the generated compilation database, so consumers like clangd or
+// indexers only have to look at the files which changed. Every line is a JSON object, the first one is the header
+// {"damnflags_journal":1,"discarded_through":N}, all others are records like
+// {"seq":42,"op":"modify","file":"/project/src/main.cpp","hash":"00c0ffee00c0ffee"}
+// with file as it is in the database. A line is only complete once it ends with a newline.
+//
+// A consumer remembers the last sequence number it handled and continues after it. Compaction replaces the file with
+// only the latest record of every file, which keep their sequence numbers, and drops the removals. A consumer whose
+// last sequence number is below discarded_through might have missed a removal and has to read the whole database.
+class change_journal final {
+   public:
+    static inline constexpr char journal_name[] = "compile_commands.journal";
+    static inline constexpr int format_version = 1;
+    // Compaction only starts with this many records, and once at least half of them are superseded
+    static inline constexpr size_t min_records_to_compact = 4096;
+
+    // Continues the journal at path if there is one, records of an interrupted write are cut off
+    static std::optional<change_journal> open(const fs::path &path);
+    // Where the compacted journal is written before it replaces the one at path
+    static fs::path compaction_path(const fs::path &path);
+
+    change_journal(const change_journal &other) = delete;
+    change_journal(change_journal &&other);
+    ~change_journal();
+
+    change_journal &operator=(const change_journal &other) = delete;
+    change_journal &operator=(change_journal &&other);
+
+    // Appends the differences to the database of the last call, or to the state of the journal when it was opened. If
+    // first_entry isn't 0 only the entries from there on were added and nothing else changed. Returns false if the
+    // changes couldn't be appended, a failed compaction is only logged and tried again once the journal doubled.
+    bool record(const nlohmann::json &database, size_t first_entry = 0);
+
+    // The sequence number of the latest record
+    uint64_t sequence() const;
+    size_t num_records() const;
+    // Records appended by the last call of record
+    size_t num_recorded() const;
+
+   private:
+    struct file_state final {
+        uint64_t hash = 0;
+        uint64_t sequence = 0;
+        journal_operation operation = journal_operation::add;
+    };
+
+    change_journal(const fs::path &path, int fd);
+
+    // Reads the records of the mapped file, returns false if it isn't a journal
+    bool load();
+    bool append(std::string_view lines);
+    bool map(size_t capacity);
+    void unmap();
+    // Keeps the number of files which weren't removed up to date
+    void update_file(std::string_view file, const file_state &state);
+    // Rewrites the journal next to it and renames it into place
+    bool compact();
+    static std::string header(uint64_t discarded_through);
+    void append_record(std::string &lines, std::string_view file, const file_state &state) const;
+
+    fs::path m_path;
+    int m_fd = -1;
+    char *m_mapping = nullptr;
+    size_t m_capacity = 0;
+    size_t m_size = 0;
+    uint64_t m_sequence = 0;
+    uint64_t m_discarded_through = 0;
+    size_t m_num_records = 0;
+    size_t m_num_recorded = 0;
+    // Raised after a failed compaction, so it isn't retried on every change
+    size_t m_next_compaction = min_records_to_compact;
+    // The latest record of every file, removed ones stay until the next compaction
+    std::unordered_map<std::string, file_state> m_files;
+    size_t m_num_live_files = 0;
+};
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "batch_io.h"
+#include "filesys.h"
+
+struct expansion_statistics final {
+    // Response files which were taken from the cache, or read from disk or missing, every file is only counted by the
+    // first lookup of a generation
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t launchers_stripped = 0;
+
+    double hit_rate() const;
+};
+
+// Resolves what split_command leaves as opaque tokens: launchers like ccache in front of the compiler and @file
+// response files. The contents of the response files are cached by path and modification time, all methods can be
+// called from multiple threads at once.
+class command_expander final {
+   public:
+    // Nested response files deeper than this are kept as they are
+    static inline constexpr size_t max_nesting_depth = 8;
+
+    static bool is_launcher(std::string_view program);
+    // Same rules as GCC: whitespace separates the arguments unless it is quoted or escaped with a backslash
+    static void split_response_file(std::string_view content, std::vector<std::string> &arguments);
+
+    // Removes the launchers in front of the compiler and replaces response files with their arguments, relative paths
+    // are resolved against directory. Unreadable response files stay as they are, new strings are allocated from
+    // storage.
+    void expand(std::pmr::vector<std::string_view> &command, std::string_view directory,
+                std::pmr::memory_resource *storage);
+    // Reads the response files of all entries of the database, so expand doesn't wait for the disk. 0 threads uses all
+    // available hardware threads. With an io backed by io_uring the files are stat'd and read in batches instead.
+    void preload(const nlohmann::json &database, unsigned int num_threads = 0, batch_io *io = nullptr);
+
+    // Response files which were read before are checked for changes once more, when they are used the next time. Starts
+    // the statistics over.
+    void next_generation();
+    // Drops a cached response file, returns false if path wasn't used as one
+    bool invalidate(std::string_view path);
+    // Drops every cached response file, they are read again when used
+    void clear();
+
+    // Since the last call of next_generation
+    expansion_statistics statistics() const;
+
+   private:
+    struct response_file final {
+        file_status status;
+        std::vector<std::string> arguments;
+    };
+
+    struct cache_entry final {
+        // Missing or unreadable response files are cached without contents for their generation
+        std::shared_ptr<const response_file> contents;
+        uint64_t validated_generation = 0;
+    };
+
+    std::shared_ptr<const response_file> load(const std::string &path);
+    std::shared_ptr<const response_file> store(const std::string &path, const file_contents &contents,
+                                               uint64_t generation);
+    std::shared_ptr<const response_file> store_missing(const std::string &path, uint64_t generation);
+    void preload_batched(const std::vector<std::string> &paths, batch_io &io);
+    void expand_arguments(const std::pmr::vector<std::string_view> &arguments, std::string_view directory,
+                          std::pmr::memory_resource *storage, std::pmr::vector<std::string_view> &expanded,
+                          size_t depth);
+
+    mutable std::shared_mutex m_mutex;
+    std::unordered_map<std::string, cache_entry> m_response_files;
+    std::atomic<uint64_t> m_generation{1};
+    std::atomic<uint64_t> m_hits{0};
+    std::atomic<uint64_t> m_misses{0};
+    std::atomic<uint64_t> m_launchers_stripped{0};
+};
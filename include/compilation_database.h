@@ -1,18 +1,51 @@
 #pragma once
 
+#include <functional>
 #include <optional>
-#include <set>
+#include <vector>
+#include <string>
 
 #include <spdlog/spdlog.h>
 #include <nlohmann/json.hpp>
 
+#include "command_expander.h"
 #include "config.h"
+#include "directory_flag_model.h"
 #include "filesys.h"
 
+class augmentation_options final {
+   public:
+    augmentation_options() = default;
+
+    // 0 uses all available hardware threads
+    augmentation_options &num_threads(unsigned int value);
+    // Polled while the entries are created, has to be callable from multiple threads
+    augmentation_options &cancellation_check(std::function<bool()> value);
+    // Model of the sources to inherit flags from, if not set a model is built from the database
+    augmentation_options &flag_model(const directory_flag_model *value);
+    // Expands the launchers and response files of the donors, if not set a temporary one is used
+    augmentation_options &expander(command_expander *value);
+
+    unsigned int num_threads() const;
+    bool is_cancelled() const;
+    const directory_flag_model *flag_model() const;
+    command_expander *expander() const;
+
+   private:
+    unsigned int m_num_threads = 1;
+    std::function<bool()> m_cancellation_check{};
+    const directory_flag_model *m_flag_model = nullptr;
+    command_expander *m_expander = nullptr;
+};
+
 // TODO Merge compilation databases if multiple ones are available
 class compilation_database final {
    public:
     static constexpr inline char database_name[] = "compile_commands.json";
+    // Below the project root, contains the response files of share_flag_sets
+    static constexpr inline char flag_set_directory_name[] = ".damnflags";
+    // In flag_set_directory_name, lists the paths of the shards written by the sharded output
+    static constexpr inline char shard_manifest_name[] = "shards";
 
     // TODO std::vector<fs::path> as argument for multiple compilation databases
     static std::optional<compilation_database> read_from(const fs::path &path);
@@ -20,8 +53,24 @@ class compilation_database final {
     void swap(compilation_database &other) noexcept;
 
     bool write_to(const fs::path &compilation_database) const;
+    // What write_to writes
+    std::string serialize() const;
+    // Extends what serialize returned before the entries from first_entry on were added, to what it would return now
+    void serialize_appended(std::string &serialized, size_t first_entry) const;
+    // Same as serialize, but only with the entries at indices
+    std::string serialize_entries(const std::vector<size_t> &indices) const;
+    static bool write_serialized_to(const fs::path &compilation_database, const std::string &serialized);
+
+    // Returns false and leaves the database untouched if nothing was added or the augmentation was cancelled. The
+    // entries are added in the order of relevant_files, which only have to contain the headers. Only the entries the
+    // database was read with are donors, so more headers can be added to an augmented database later on.
+    bool add_missing_files(const std::vector<fs::path> &relevant_files, const config &conf,
+                           const augmentation_options &options = {});
 
-    bool add_missing_files(const std::set<fs::path> &relevant_files, const config &conf);
+    // Replaces the commands of the added entries with the arguments form and moves their flags into response files in
+    // flag_set_directory, which are shared by all entries with the same flags. Entries which were already shared by an
+    // earlier call keep their response files.
+    bool share_flag_sets(const fs::path &flag_set_directory);
 
     const nlohmann::json &database() const;
 
@@ -29,4 +78,6 @@ class compilation_database final {
     compilation_database(nlohmann::json database);
 
     nlohmann::json m_database;
+    // Everything behind these entries was added by add_missing_files
+    size_t m_num_original_entries = 0;
 };
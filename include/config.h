@@ -7,6 +7,7 @@
 
 #include <nlohmann/json.hpp>
 
+#include "directory_flag_model.h"
 #include "filesys.h"
 
 // TODO do proper caching instead of reading the json every time
@@ -23,12 +24,49 @@ class config {
     config &get_flags_from(const std::string &value);
     config &whitelist_regex(const std::vector<std::string> &regex);
     config &blacklist_regex(const std::vector<std::string> &regex);
+    config &flag_inheritance(const std::string &value);
+    config &canonicalize_flags(bool value);
+    config &compact_output(bool value);
+    config &lazy_augmentation(bool value);
+    config &max_lazy_entries(size_t value);
+    config &sharded_output(bool value);
+    config &merged_output(bool value);
+    config &max_memory_mb(size_t value);
+    config &max_threads(unsigned int value);
+    config &max_regenerations_per_minute(unsigned int value);
+    config &io_uring_backend(bool value);
+    config &change_journal(bool value);
 
     std::optional<fs::path> project_root() const;
     std::optional<fs::path> compilation_database_path() const;
     std::optional<std::string> get_flags_from() const;
     std::vector<std::string> whitelist_patterns() const;
     std::vector<std::string> blacklist_patterns() const;
+    // The whitelist patterns with the variables like ${project_root} replaced, as they are matched
+    std::vector<std::string> resolved_whitelist_patterns() const;
+    std::optional<std::string> flag_inheritance() const;
+    // How headers without matching source inherit the flags of their directory, "intersection" or "majority"
+    flag_aggregation flag_aggregation_mode() const;
+    // Drop duplicate include paths and defines, make include paths relative to the directory where that is shorter
+    bool canonicalize_flags() const;
+    // Write the added entries in the arguments form with response files for the flags shared between entries
+    bool compact_output() const;
+    // Only generate entries for the headers which were used recently instead of for every header in the project
+    bool lazy_augmentation() const;
+    // Upper bound of the headers with generated entries in the lazy mode, the least recently used ones are evicted
+    size_t max_lazy_entries() const;
+    // Write a compile_commands.json into every top-level directory of the project instead of one for everything
+    bool sharded_output() const;
+    // Keep a merged database of all shards up to date, it is only written while no events arrive
+    bool merged_output() const;
+    // Budgets for running next to heavy builds, 0 means no budget
+    size_t max_memory_mb() const;
+    unsigned int max_threads() const;
+    unsigned int max_regenerations_per_minute() const;
+    // Batch the stats and reads of scans and response files with io_uring, if the kernel supports it
+    bool io_uring_backend() const;
+    // Append the entries which were added, modified or removed by every write of the database to a journal next to it
+    bool change_journal() const;
     const std::vector<std::regex> &prepared_blacklist_patterns() const;
     const std::vector<std::regex> &prepared_whitelist_patterns() const;
 
@@ -37,12 +75,28 @@ class config {
     void update_patterns();
 
     std::string load_variables(const std::string &pattern) const;
+    bool boolean_option(const char *key, bool default_value) const;
+    size_t unsigned_option(const char *key, size_t default_value) const;
 
     static inline constexpr char project_root_key[] = "project_root";
     static inline constexpr char compilation_database_path_key[] = "compdb_path";
     static inline constexpr char whitelist_patterns_key[] = "whitelist_patterns";
     static inline constexpr char blacklist_patterns_key[] = "blacklist_patterns";
     static inline constexpr char get_flags_from_key[] = "get_flags_from";
+    static inline constexpr char flag_inheritance_key[] = "flag_inheritance";
+    static inline constexpr char canonicalize_flags_key[] = "canonicalize_flags";
+    static inline constexpr char compact_output_key[] = "compact_output";
+    static inline constexpr char lazy_augmentation_key[] = "lazy_augmentation";
+    static inline constexpr char max_lazy_entries_key[] = "max_lazy_entries";
+    static inline constexpr char sharded_output_key[] = "sharded_output";
+    static inline constexpr char merged_output_key[] = "merged_output";
+    static inline constexpr char max_memory_mb_key[] = "max_memory_mb";
+    static inline constexpr char max_threads_key[] = "max_threads";
+    static inline constexpr char max_regenerations_per_minute_key[] = "max_regenerations_per_minute";
+    static inline constexpr char io_uring_backend_key[] = "io_uring_backend";
+    static inline constexpr char change_journal_key[] = "change_journal";
+
+    static inline constexpr size_t default_max_lazy_entries = 256;
 
     nlohmann::json m_conf{};
     std::vector<std::regex> m_prepared_blacklist{};
@@ -52,6 +106,17 @@ class config {
     {
         "project_root": "${working_dir}",
         "get_flags_from" : "${project_root}/src/main.cpp",
+        "flag_inheritance" : "majority",
+        "canonicalize_flags" : false,
+        "compact_output" : false,
+        "lazy_augmentation" : false,
+        "sharded_output" : false,
+        "merged_output" : false,
+        "max_memory_mb" : 0,
+        "max_threads" : 0,
+        "max_regenerations_per_minute" : 0,
+        "io_uring_backend" : false,
+        "change_journal" : false,
         "whitelist_patterns" : ["${project_root}/src", "${project_root}/include", "${project_root}/build/compile_commands.json"]
     }
     )";
@@ -0,0 +1,36 @@
+#pragma once
+
+// Public entry point of libdamnflags, embedders should only need to include this header
+
+#include <optional>
+
+#include "compilation_database.h"
+#include "config.h"
+#include "filesys.h"
+#include "logger.h"
+#include "utils.h"
+#include "workspace.h"
+
+#define DAMNFLAGS_VERSION_MAJOR 0
+#define DAMNFLAGS_VERSION_MINOR 1
+#define DAMNFLAGS_VERSION_PATCH 0
+
+struct damnflags_version final {
+    static inline constexpr int major = DAMNFLAGS_VERSION_MAJOR;
+    static inline constexpr int minor = DAMNFLAGS_VERSION_MINOR;
+    static inline constexpr int patch = DAMNFLAGS_VERSION_PATCH;
+};
+
+enum struct generation_result : int {
+    success = 0,
+    invalid_project = 1,
+    missing_database = 2,
+    invalid_database = 3,
+    write_failed = 4
+};
+
+// Scans the project, adds the missing files to its compilation database and writes the result to the project root.
+// Unlike workspace::discover_project no watches are set up, so this can be used for one-shot runs.
+// num_threads is used for scanning and augmenting, 0 uses all available hardware threads.
+generation_result generate_compilation_database(const fs::path &project_path, const std::optional<config> &conf = {},
+                                                unsigned int num_threads = 0);
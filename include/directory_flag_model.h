@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+class command_expander;
+
+enum struct flag_aggregation { majority, intersection };
+
+struct inherited_flags final {
+    // Starts with the compiler of the sources
+    std::vector<std::string> command;
+    std::string directory;
+};
+
+// Aggregates the flags of all sources below a directory, so a header without a matching source can inherit the flags of
+// the nearest ancestor directory which contains sources. Every source contributes to all of its ancestors, so updates
+// and lookups take O(depth).
+class directory_flag_model final {
+   public:
+    directory_flag_model(flag_aggregation aggregation = flag_aggregation::majority);
+
+    // Synchronizes the model with the entries of the database, only entries which changed are updated. Changes of
+    // the response files don't change the entries, so the model has to be rebuilt after those.
+    void update_from(const nlohmann::json &database, command_expander *expander = nullptr);
+    void add_entry(std::string_view file, std::string_view directory, std::string_view command,
+                   command_expander *expander = nullptr);
+    void remove_entry(std::string_view file);
+
+    // Has to be called after changing the model and before lookup
+    void refresh();
+    // Not synchronized with the modifying methods, but can be called from multiple threads at once
+    const inherited_flags *lookup(std::string_view path) const;
+
+    size_t num_entries() const;
+
+   private:
+    struct directory_node final {
+        std::map<std::string, std::unique_ptr<directory_node>, std::less<>> children;
+        // Ordered by first appearance, so the aggregated flags keep the order of the sources
+        std::vector<std::pair<std::string, size_t>> flag_counts;
+        std::unordered_map<std::string, size_t> flag_positions;
+        std::map<std::string, size_t, std::less<>> compiler_counts;
+        std::map<std::string, size_t, std::less<>> directory_counts;
+        size_t num_sources = 0;
+        bool dirty = false;
+        inherited_flags aggregated;
+    };
+
+    struct entry_record final {
+        std::string directory;
+        std::vector<std::string> command;
+        uint64_t hash = 0;
+        uint64_t generation = 0;
+    };
+
+    void apply(std::string_view file, const entry_record &record, bool add);
+    void refresh(directory_node &node);
+
+    flag_aggregation m_aggregation;
+    directory_node m_root;
+    std::unordered_map<std::string, entry_record> m_entries;
+    uint64_t m_generation = 0;
+};
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <optional>
+#include <utility>
+#include <vector>
+
+// Bounded lock-free queue for exactly one producer and one consumer thread
+template<typename T, size_t Capacity>
+class spsc_queue final {
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "The capacity has to be a power of two");
+
+   public:
+    spsc_queue() : m_buffer(Capacity) {}
+
+    spsc_queue(const spsc_queue &other) = delete;
+    spsc_queue &operator=(const spsc_queue &other) = delete;
+
+    // Only call from the producer thread
+    bool try_push(T value) {
+        const size_t tail = m_tail.load(std::memory_order_relaxed);
+
+        if (tail - m_cached_head == Capacity) {
+            m_cached_head = m_head.load(std::memory_order_acquire);
+
+            if (tail - m_cached_head == Capacity) {
+                return false;
+            }
+        }
+
+        m_buffer[tail & (Capacity - 1)] = std::move(value);
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Only call from the consumer thread
+    std::optional<T> try_pop() {
+        const size_t head = m_head.load(std::memory_order_relaxed);
+
+        if (head == m_cached_tail) {
+            m_cached_tail = m_tail.load(std::memory_order_acquire);
+
+            if (head == m_cached_tail) {
+                return std::nullopt;
+            }
+        }
+
+        std::optional<T> value(std::move(m_buffer[head & (Capacity - 1)]));
+        m_head.store(head + 1, std::memory_order_release);
+        return value;
+    }
+
+    static constexpr size_t capacity() { return Capacity; }
+
+   private:
+    // Keep the indices of the producer and the consumer on separate cache lines
+    alignas(64) std::atomic<size_t> m_head{0};
+    size_t m_cached_tail = 0;
+    alignas(64) std::atomic<size_t> m_tail{0};
+    size_t m_cached_head = 0;
+    alignas(64) std::vector<T> m_buffer;
+};
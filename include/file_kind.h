@@ -0,0 +1,131 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+enum struct file_kind : uint8_t { other, source, header };
+
+struct extension_kind final {
+    std::string_view extension;
+    file_kind kind;
+};
+
+// The extensions, without the dot, which are treated as sources or headers. The lookup table is generated from this at
+// compile time, so adding an extension here is all that's needed.
+inline constexpr std::array<extension_kind, 18> known_extensions{{
+    {"c", file_kind::source},
+    {"cc", file_kind::source},
+    {"cpp", file_kind::source},
+    {"cxx", file_kind::source},
+    {"c++", file_kind::source},
+    {"cu", file_kind::source},
+    {"m", file_kind::source},
+    {"mm", file_kind::source},
+    {"h", file_kind::header},
+    {"hh", file_kind::header},
+    {"hpp", file_kind::header},
+    {"hxx", file_kind::header},
+    {"h++", file_kind::header},
+    {"cuh", file_kind::header},
+    {"ipp", file_kind::header},
+    {"inl", file_kind::header},
+    {"tpp", file_kind::header},
+    {"tcc", file_kind::header},
+}};
+
+namespace detail {
+
+inline constexpr size_t extension_table_bits = 6;
+inline constexpr size_t extension_table_size = size_t(1) << extension_table_bits;
+
+inline constexpr size_t max_extension_length = [] {
+    size_t result = 0;
+
+    for (const auto &current_extension : known_extensions) {
+        result = current_extension.extension.size() > result ? current_extension.extension.size() : result;
+    }
+
+    return result;
+}();
+
+constexpr size_t extension_slot(std::string_view extension, uint32_t seed) {
+    uint32_t hash = seed ^ static_cast<uint32_t>(extension.size());
+
+    for (char current_char : extension) {
+        hash = (hash ^ static_cast<uint8_t>(current_char)) * 0x01000193u;
+    }
+
+    return hash >> (32 - extension_table_bits);
+}
+
+// Every slot holds the index into known_extensions plus one, zero marks an empty slot
+using extension_table = std::array<uint8_t, extension_table_size>;
+
+constexpr bool fill_extension_table(extension_table &table, uint32_t seed) {
+    table = extension_table{};
+
+    for (size_t i = 0; i < known_extensions.size(); ++i) {
+        auto &slot = table[extension_slot(known_extensions[i].extension, seed)];
+
+        if (slot != 0) {
+            return false;
+        }
+
+        slot = static_cast<uint8_t>(i + 1);
+    }
+
+    return true;
+}
+
+// Searches for a seed which maps every known extension to its own slot, so a lookup is one hash and one comparison
+inline constexpr uint32_t extension_seed = [] {
+    extension_table table{};
+
+    for (uint32_t seed = 0; seed < 4096; ++seed) {
+        if (fill_extension_table(table, seed)) {
+            return seed;
+        }
+    }
+
+    return uint32_t(~0u);
+}();
+
+static_assert(extension_seed != ~0u, "No collision free seed for the known extensions, increase extension_table_bits");
+
+inline constexpr extension_table extension_lookup = [] {
+    extension_table table{};
+    fill_extension_table(table, extension_seed);
+    return table;
+}();
+
+}  // namespace detail
+
+// Classifies an extension without the dot
+constexpr file_kind classify_extension(std::string_view extension) {
+    if (extension.empty() || extension.size() > detail::max_extension_length) {
+        return file_kind::other;
+    }
+
+    const uint8_t slot = detail::extension_lookup[detail::extension_slot(extension, detail::extension_seed)];
+
+    if (slot == 0 || known_extensions[slot - 1].extension != extension) {
+        return file_kind::other;
+    }
+
+    return known_extensions[slot - 1].kind;
+}
+
+// Follows the rules of fs::path::extension, so hidden files like .h don't have an extension
+constexpr file_kind classify_file(std::string_view path) {
+    auto separator = path.rfind('/');
+    auto filename = separator == std::string_view::npos ? path : path.substr(separator + 1);
+    auto dot = filename.rfind('.');
+
+    if (dot == std::string_view::npos || dot == 0) {
+        return file_kind::other;
+    }
+
+    return classify_extension(filename.substr(dot + 1));
+}
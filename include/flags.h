@@ -0,0 +1,18 @@
+#pragma once
+
+#include <memory_resource>
+#include <string_view>
+#include <vector>
+
+// Options which take their value as the next argument, if it isn't joined, e.g. -I include or -o file.o
+bool takes_separate_argument(std::string_view flag);
+
+// Canonicalizes the flags of a command, the compiler in the first position stays in front:
+//  - the values of separate -I, -D and -U options are joined with the option
+//  - include paths are normalized and made relative to directory, if that is shorter
+//  - duplicate include paths and defines are removed
+//  - defines and include paths are moved behind the other flags, keeping their relative order, which doesn't change
+//    their meaning
+// Newly created strings are allocated from storage, which has to outlive command.
+void canonicalize_flags(std::pmr::vector<std::string_view> &command, std::string_view directory,
+                        std::pmr::memory_resource *storage);
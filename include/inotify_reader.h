@@ -0,0 +1,60 @@
+#pragma once
+
+// clang-format off
+#include <sys/inotify.h>
+#include <cstdint>
+// clang-format on
+
+#include <atomic>
+#include <chrono>
+#include <optional>
+#include <string>
+#include <thread>
+
+#include "event_queue.h"
+
+struct inotify_record final {
+    uint32_t mask = 0;
+    int directory_watch = -1;
+    uint32_t cookie = 0;
+    std::string name;
+};
+
+// Drains the inotify descriptor on its own thread, so the kernel queue can't overflow while the database is rebuilt
+class inotify_reader final {
+   public:
+    static inline constexpr size_t queue_capacity = 16384;
+    // Events which can change the relevant files or the compilation database, everything else can't make a rebuild
+    // stale
+    static inline constexpr uint32_t changing_events =
+        IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_DELETE_SELF | IN_MODIFY | IN_MOVE_SELF | IN_MOVED_FROM |
+        IN_MOVED_TO;
+
+    inotify_reader(int notify_fd);
+    inotify_reader(const inotify_reader &other) = delete;
+    ~inotify_reader();
+
+    inotify_reader &operator=(const inotify_reader &other) = delete;
+
+    bool start();
+
+    // Blocks until the reader thread has queued new events, or until the timeout expired
+    bool wait_for_events(std::optional<std::chrono::milliseconds> timeout = {});
+    std::optional<inotify_record> next_event();
+
+    // Increases with every queued event of the changing_events kind
+    uint64_t change_generation() const;
+    // Resets the flag, if set events were lost and the state has to be rebuilt from the filesystem
+    bool overflowed();
+
+   private:
+    void read_events();
+
+    int m_notify_fd = -1;
+    int m_wakeup_fd = -1;
+    int m_stop_fd = -1;
+    std::thread m_reader_thread;
+    spsc_queue<inotify_record, queue_capacity> m_queue;
+    std::atomic<uint64_t> m_change_generation{0};
+    std::atomic<bool> m_overflowed{false};
+};
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "filesys.h"
+
+using path_id = uint32_t;
+
+inline constexpr path_id invalid_path_id = std::numeric_limits<path_id>::max();
+
+// Interns paths as a tree of names, every path is stored once as the ID of its parent plus its last component. Lookups
+// of known paths don't allocate and an ID stays valid as long as the table exists.
+class path_table final {
+   public:
+    // Stands for the start of a relative path, absolute paths start with the component "/" below it
+    static inline constexpr path_id root_id = 0;
+
+    path_table();
+
+    // An empty name refers to the parent itself
+    path_id intern(path_id parent, std::string_view name);
+    path_id intern(std::string_view path);
+    // Same as intern, but returns invalid_path_id instead of adding unknown paths
+    path_id find(path_id parent, std::string_view name) const;
+    path_id find(std::string_view path) const;
+
+    path_id parent(path_id id) const;
+    // Only valid until the next call to intern or rename
+    std::string_view name(path_id id) const;
+    bool is_within(path_id id, path_id ancestor) const;
+
+    // Moves id with everything below it, the IDs stay the same. A path which already exists at the destination is
+    // detached, so it can't be found anymore.
+    void rename(path_id id, path_id new_parent, std::string_view new_name);
+
+    // Calls func with id and everything below it, parents before their children
+    template<typename Func>
+    void for_each_descendant(path_id id, Func func) const {
+        func(id);
+
+        for (auto current_id = m_nodes[id].first_child; current_id != invalid_path_id;) {
+            func(current_id);
+
+            // Depth first without a stack: the first child, otherwise the next sibling of the node or of an ancestor
+            if (m_nodes[current_id].first_child != invalid_path_id) {
+                current_id = m_nodes[current_id].first_child;
+                continue;
+            }
+
+            while (current_id != id && m_nodes[current_id].next_sibling == invalid_path_id) {
+                current_id = m_nodes[current_id].parent;
+            }
+
+            current_id = current_id != id ? m_nodes[current_id].next_sibling : invalid_path_id;
+        }
+    }
+
+    // Replaces the content of buffer, so its memory can be reused for every path
+    void write_path(path_id id, std::string &buffer) const;
+    fs::path path(path_id id) const;
+
+    size_t size() const;
+    size_t memory_usage() const;
+
+   private:
+    struct path_node final {
+        path_id parent = invalid_path_id;
+        uint32_t name_offset = 0;
+        uint32_t name_length = 0;
+        path_id first_child = invalid_path_id;
+        path_id next_sibling = invalid_path_id;
+    };
+
+    size_t find_slot(path_id parent, std::string_view name) const;
+    void erase_slot(size_t slot);
+    void grow_slots();
+    void link(path_id id);
+    void unlink(path_id id);
+    bool separated_from_parent(const path_node &node) const;
+
+    std::vector<path_node> m_nodes;
+    std::string m_names;
+    // Open addressing with linear probing, holds the IDs of all nodes but the root
+    std::vector<path_id> m_slots;
+};
+
+// Set of IDs of a path_table as a bitmap, the IDs are dense so this takes one bit per interned path
+class path_id_set final {
+   public:
+    // Both return false if nothing changed
+    bool insert(path_id id);
+    bool erase(path_id id);
+    bool contains(path_id id) const;
+    void clear();
+    size_t size() const;
+
+    // Calls func with every ID in the set, in ascending order
+    template<typename Func>
+    void for_each(Func func) const {
+        for (size_t word_index = 0; word_index < m_words.size(); ++word_index) {
+            for (uint64_t word = m_words[word_index]; word != 0; word &= word - 1) {
+                func(static_cast<path_id>(word_index * 64 + __builtin_ctzll(word)));
+            }
+        }
+    }
+
+   private:
+    std::vector<uint64_t> m_words;
+    size_t m_size = 0;
+};
+
+// The most recently used IDs of a path_table up to a capacity. The order is a list threaded through a vector indexed by
+// the ID, so touching an entry doesn't allocate.
+class path_lru final {
+   public:
+    explicit path_lru(size_t capacity = 0);
+
+    // Makes id the most recently used entry, returns false if it already was in the set
+    bool touch(path_id id);
+    // Removes the least recently used entry if there are more than capacity, returns invalid_path_id otherwise
+    path_id evict_excess();
+    bool erase(path_id id);
+    bool contains(path_id id) const;
+    void clear();
+    size_t size() const;
+    // Lowering it doesn't evict anything by itself, that's up to evict_excess
+    void capacity(size_t value);
+    size_t capacity() const;
+
+    // Calls func with every ID in the set, the most recently used first
+    template<typename Func>
+    void for_each(Func func) const {
+        for (auto current_id = m_newest; current_id != invalid_path_id; current_id = m_links[current_id].older) {
+            func(current_id);
+        }
+    }
+
+   private:
+    struct lru_links final {
+        path_id newer = invalid_path_id;
+        path_id older = invalid_path_id;
+        bool contained = false;
+    };
+
+    void unlink(path_id id);
+
+    std::vector<lru_links> m_links;
+    path_id m_newest = invalid_path_id;
+    path_id m_oldest = invalid_path_id;
+    size_t m_size = 0;
+    size_t m_capacity = 0;
+};
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <optional>
+#include <string>
+
+class config;
+
+// 0 means no budget
+struct resource_limits final {
+    size_t max_memory_bytes = 0;
+    unsigned int max_threads = 0;
+    unsigned int max_regenerations_per_minute = 0;
+
+    static resource_limits from_config(const config &conf);
+};
+
+// Measures the resources the daemon uses against the budgets of the config. What to give up when it is over budget is
+// up to the workspace, this only tells when.
+class resource_budget final {
+   public:
+    using clock = std::chrono::steady_clock;
+
+    // The window the regenerations are counted in
+    static inline constexpr std::chrono::minutes regeneration_window{1};
+
+    explicit resource_budget(const resource_limits &limits = {});
+
+    // From /proc/self/statm, nothing if it can't be read
+    static std::optional<size_t> resident_memory();
+
+    void limits(const resource_limits &limits);
+    const resource_limits &limits() const;
+
+    // Threads for parallel work: requested, or all hardware threads for 0, but not more than the budget
+    unsigned int worker_threads(unsigned int requested = 0) const;
+    // Measures the memory again
+    bool memory_exceeded();
+    // How long a regeneration has to wait until it fits into the budget, 0 if it can run right away
+    std::chrono::milliseconds regeneration_delay(clock::time_point now = clock::now());
+    void regenerated(clock::time_point now = clock::now());
+
+    // Current use against every budget, as measured last
+    std::string report() const;
+
+   private:
+    void expire_regenerations(clock::time_point now);
+
+    resource_limits m_limits;
+    size_t m_resident_memory = 0;
+    // Sorted, only the ones in the window are kept
+    std::deque<clock::time_point> m_regenerations;
+};
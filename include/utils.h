@@ -1,24 +1,37 @@
 #pragma once
 
 #include <algorithm>
+#include <cstdint>
+#include <memory_resource>
 #include <sstream>
 #include <string>
 #include <string_view>
 #include <utility>
 #include <vector>
 
-#include "filesys.h"
-
-template<typename T>
-bool matches_extension(const fs::path &path, T begin, T end) {
-    if (!path.has_extension()) {
-        return false;
-    }
+#include <nlohmann/json.hpp>
 
-    return std::find(begin, end, path.extension().c_str()) != end;
-}
+#include "file_kind.h"
+#include "filesys.h"
 
 bool is_source_file(const fs::path &path);
 bool is_header_file(const fs::path &path);
+// Splits at any whitespace, runs of it count as one separator
 std::vector<std::string> split_command(const std::string &command_line);
+// Same as above, but appends the parts to parts without copying them, the views point into command_line
+void split_command(std::string_view command_line, std::pmr::vector<std::string_view> &parts);
+// Flags which only make sense for the file they were used with, like -o and -c, or which aren't flags at all
+bool remove_specific_flag(std::string_view current_flag);
+// Removes those flags from everything but the compiler in the first position, keeps the separate values of options
+void remove_specific_flags(std::pmr::vector<std::string_view> &command);
+// Same as fs::path::filename and fs::path::replace_extension, but without allocating
+std::string_view filename_of(std::string_view path);
+std::string_view without_extension(std::string_view path);
+// The string member key of a JSON object like an entry of the database, empty if it is missing or isn't a string
+std::string_view string_member(const nlohmann::json &entry, const char *key);
+// Same as fs::path::lexically_normal, without the allocations of fs::path for paths which are already normal
+std::string normalized_path(std::string_view path);
+// Fast non-cryptographic 64 bit hash, only meant for change detection
+uint64_t hash_bytes(std::string_view data, uint64_t seed = 0);
+// Replaces the first occurrence of to_replace
 void replace_pattern_with(std::string &str, std::string_view to_replace, std::string_view replace_with);
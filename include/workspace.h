@@ -9,14 +9,27 @@
 // clang-format off
 
 #include <bitset>
+#include <chrono>
 #include <functional>
 #include <map>
+#include <memory>
 #include <optional>
 #include <set>
+#include <string>
+#include <string_view>
+#include <vector>
 
+#include "batch_io.h"
+#include "change_detector.h"
+#include "change_journal.h"
+#include "command_expander.h"
 #include "compilation_database.h"
 #include "config.h"
+#include "directory_flag_model.h"
 #include "filesys.h"
+#include "inotify_reader.h"
+#include "path_table.h"
+#include "resource_budget.h"
 
 enum struct workspace_events : uint32_t {
     accessed = IN_ACCESS,
@@ -40,16 +53,27 @@ class workspace_event final {
         workspace_event(workspace_events event_mask, const fs::path &path);
 
         workspace_events event_mask() const;
+        // Only converted into a fs::path on first use
         const fs::path &affected_path() const;
+        std::string_view affected_path_view() const;
 
     private:
+        // path has to outlive the event
+        workspace_event(workspace_events event_mask, path_id affected_id, std::string_view path);
+
         std::optional<int> directory_watch() const;
+        path_id affected_id() const;
 
         workspace_event &directory_watch(int watch);
 
         const workspace_events m_event_mask;
-        const fs::path m_affected_path;
+        // invalid_path_id if the path isn't interned yet
+        path_id m_affected_id = invalid_path_id;
+        std::string_view m_affected_path_view{};
+        mutable std::optional<fs::path> m_affected_path{};
         std::optional<int> m_directory_watch{};
+        // One half of a directory move, which the workspace already applied
+        bool m_is_paired_move = false;
 
         friend class workspace;
 };
@@ -58,8 +82,17 @@ class workspace final {
    public:
     using handler_type = std::function<void(workspace &workspace_instance, const workspace_event &event)>;
 
-    static std::optional<workspace> discover_project(const fs::path &project_path, const std::optional<config> &conf = {});
+    // Changes to config_path are applied while running, without conf that is the damnflags_conf.json in the project
+    static std::optional<workspace> discover_project(const fs::path &project_path,
+                                                     const std::optional<config> &conf = {},
+                                                     const std::optional<fs::path> &config_path = {});
+    // Uses conf if available, otherwise the damnflags_conf.json in the project or an empty config
+    static config resolve_config(const fs::path &project_path, const std::optional<config> &conf = {});
     static bool is_relevant_file(const fs::path &file, const config &conf);
+    // Only checks the filesystem if is_regular_file isn't known and the name alone doesn't decide it
+    static bool is_relevant_file(std::string_view file, const config &conf, std::optional<bool> is_regular_file = {});
+    // The shards and the merged database an earlier run wrote into the project, none of them can be the input
+    static std::set<fs::path> generated_databases(const fs::path &project_path);
     workspace(const workspace &other) = delete;
     workspace(workspace &&other);
     ~workspace();
@@ -70,27 +103,155 @@ class workspace final {
     void swap(workspace &other);
     void compilation_database_is_dirty();
 
-    bool check_for_updates();
+    // Returns false if no events arrived before the timeout
+    bool check_for_updates(std::optional<std::chrono::milliseconds> timeout = {});
+
+    // Makes sure the header has an entry in the lazy mode, rebuilding the compilation database right away if it
+    // didn't. The path has to be in the same form as the project root, returns false if it isn't a relevant header.
+    bool request_header(const fs::path &header);
+
+    // The database with every entry, with the sharded output it's only written when this is called or when idle and
+    // merged_output is set
+    std::optional<fs::path> merged_database();
 
     const fs::path project_root() const;
     const fs::path compilation_database_path() const;
 
    private:
     workspace(int notify_fd,
-              std::map<int, fs::path> directory_watches, const config &conf);
+              std::map<int, fs::path> directory_watches, const config &conf, std::optional<fs::path> config_path);
 
     void update_compilation_database();
+    fs::path temporary_database_path() const;
     void populate_relevant_files();
     void inotify_handler();
-    void send_event(uint32_t mask, const fs::path &affected_path, int directory_watch);
+    void send_event(uint32_t mask, path_id affected_id, std::string_view affected_path, int directory_watch,
+                    bool is_paired_move = false);
     static void default_handler(workspace &workspace_instance, const workspace_event &event);
-    bool is_relevant_file(const fs::path &file) const;
+    void add_directory_watch(std::string_view directory);
+    void remove_directory_watch(int directory_watch);
+    void set_directory_watch(int directory_watch, path_id directory_id);
+    path_id watched_path(int directory_watch) const;
+    path_id add_relevant_file(std::string_view file);
+    // The config or the memory budget can switch to the lazy mode
+    bool lazy_augmentation() const;
+    // Fills the working set with the published headers up to its capacity, so switching to the lazy mode only drops
+    // the entries which don't fit instead of all of them
+    void seed_active_headers();
+    // Adds a relevant header to the working set of the lazy mode, returns true if it wasn't in there before
+    bool activate_header(path_id header);
+    bool is_relevant_header(path_id file) const;
+    // Queues a header without an entry in the published database for publish_priority_headers
+    void prioritize_header(path_id header);
+    // Appends the entries of the queued headers to the published database and writes it, before the full rebuild
+    void publish_priority_headers();
+    // Removes the relevant files and watches of root and everything below it
+    void remove_subtree(path_id root);
+    // Keeps the IDs, watches and relevant files below the directory, only their paths change
+    void move_directory(path_id directory, path_id new_parent, std::string_view new_name);
+    // Handles the moves without a second half as deletions, once move_pairing_timeout expired
+    void flush_expired_moves();
+    // Watches and adds everything below a directory which appeared after the initial scan
+    void scan_directory(std::string_view directory);
+    // Like scan_directory, without adding the directory itself
+    void scan_below(const fs::path &directory);
+    // Scans the project root with scan_directory, or below it if the root itself isn't relevant
+    void scan_project_root();
+    // Removes the watches of directories which aren't relevant files anymore, except the ones of the input database
+    // and the config
+    void remove_irrelevant_watches();
+    // Scans the entries of directory whose names start with name_prefix, if they are relevant
+    void scan_prefix(const fs::path &directory, std::string_view name_prefix);
+    // Watches the directory of the config file, without the other events of it if it isn't relevant
+    void watch_config_file();
+    // Keeps the previous config if the new one can't be read
+    void reload_config();
+    // Only the paths matching the added or removed patterns are checked again
+    void update_relevance(const config &previous);
+    // Calls func with the ID of every header which gets an entry
+    template<typename Func>
+    void for_each_augmented_header(Func func) const;
+    // Sorted, so the generated database doesn't depend on the order of the events
+    std::vector<fs::path> relevant_headers() const;
+    // Only the entries from appended_from on are serialized, if the ones before didn't change since the last write.
+    // Returns false if the database couldn't be written.
+    bool write_compilation_database(std::optional<size_t> appended_from = {});
+    // Writes the shards of the entries from appended_from on, or all of them, if their content changed. Returns false
+    // if one of them couldn't be written.
+    bool write_shards(std::optional<size_t> appended_from);
+    void write_shard_manifest();
+    // Appends what changed since the last write to the change journal, if it is enabled
+    void record_changes(std::optional<size_t> appended_from);
+    // Empty shard for the project root
+    fs::path shard_path(std::string_view shard) const;
+    // Writes the file next to it first and renames it, events for both are ignored
+    bool replace_file(const fs::path &path, const std::string &content);
+    // The flag model only notices changed entries, so it is rebuilt if one of the response files changed
+    void response_file_changed();
+    // Drops the caches when over the memory budget, and switches to the lazy augmentation if that isn't enough
+    void enforce_budget();
+
+    struct pending_move final {
+        uint32_t cookie = 0;
+        uint32_t mask = 0;
+        int directory_watch = -1;
+        path_id affected_id = invalid_path_id;
+        std::string path;
+        std::chrono::steady_clock::time_point expires_at{};
+    };
+
+    // The kernel queues both halves of a move at once, but they can still be read in different batches
+    static inline constexpr std::chrono::milliseconds move_pairing_timeout{100};
+
+    // A rebuild is cancelled if newer changes arrive while it is running, but only this often in a row
+    static inline constexpr unsigned int max_rebuild_restarts = 3;
+
+    // A rebuild whose write failed is tried again after this, even without new events
+    static inline constexpr std::chrono::milliseconds write_retry_delay{1000};
 
     config m_config;
+    std::optional<fs::path> m_config_path;
+    path_id m_config_id = invalid_path_id;
+    std::unique_ptr<inotify_reader> m_event_reader;
     std::vector<handler_type> m_event_handlers;
-    std::map<int, fs::path> m_directory_watches;
-    std::set<fs::path> m_relevant_files;
+    path_table m_paths;
+    // Indexed by the watch descriptor, which the kernel hands out in ascending order
+    std::vector<path_id> m_directory_watches;
+    // The other direction, -1 for paths without a watch
+    std::vector<int> m_path_watches;
+    path_id_set m_relevant_files;
+    // The headers which get entries in the lazy mode
+    path_lru m_active_headers;
+    // Reused for the path of every event, and for all other paths, since the event path is still in use meanwhile
+    std::string m_event_path;
+    std::string m_path_buffer;
+    // Directories moved away, until the matching moved_to arrives
+    std::vector<pending_move> m_pending_moves;
+    // Headers from the latest events, which are published before the full rebuild
+    std::vector<path_id> m_priority_headers;
+    // The headers with an entry in m_compilation_database
+    path_id_set m_published_headers;
     int m_notify_fd = 0;
     bool m_dirty_compilation_database = true;
+    bool m_rebuild_cancelled = false;
+    unsigned int m_rebuild_restarts = 0;
+    // The database which was written last
     std::optional<compilation_database> m_compilation_database;
+    std::string m_published_serialization;
+    // Hashes of the shards as they were written last, by their top-level directory
+    std::map<std::string, uint64_t, std::less<>> m_shard_hashes;
+    bool m_merged_database_stale = true;
+    // Opened with the first write of the database after the journal was enabled
+    std::optional<change_journal> m_change_journal;
+    change_detector m_change_detector;
+    directory_flag_model m_flag_model;
+    // Shared by the flag model and the augmentation, on the heap since it can't be moved
+    std::unique_ptr<command_expander> m_command_expander;
+    // Every scan and the preloading of the response files go through this
+    batch_io m_io;
+    resource_budget m_budget;
+    // The lazy augmentation was forced by the memory budget, on top of what the config says
+    bool m_memory_degraded = false;
+    // When a regeneration which was over the budget or whose write failed is due
+    std::optional<std::chrono::steady_clock::time_point> m_deferred_regeneration;
 };
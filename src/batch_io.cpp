@@ -0,0 +1,569 @@
+// clang-format off
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+// clang-format on
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "batch_io.h"
+
+// Opening and stat'ing files through io_uring needs Linux 5.6, liburing isn't needed for the few calls used here
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+
+#if defined(IORING_FEAT_RW_CUR_POS) && defined(__NR_io_uring_setup)
+#define DAMNFLAGS_HAS_IO_URING 1
+#endif
+
+namespace {
+
+file_status status_of(mode_t mode, uintmax_t size, int64_t seconds, int64_t nanoseconds) {
+    file_status status;
+    status.is_directory = S_ISDIR(mode);
+    status.is_regular_file = S_ISREG(mode);
+    status.size = size;
+    status.modification_time = std::chrono::seconds(seconds) + std::chrono::nanoseconds(nanoseconds);
+
+    return status;
+}
+
+file_status status_of(const struct stat &result) {
+    return status_of(result.st_mode, static_cast<uintmax_t>(result.st_size), result.st_mtim.tv_sec,
+                     result.st_mtim.tv_nsec);
+}
+
+// Reads until size bytes or the end of the file, counting the syscalls
+bool read_fully(int fd, std::string &content, size_t offset, uint64_t &syscalls) {
+    while (offset < content.size()) {
+        const ssize_t num_read = pread(fd, content.data() + offset, content.size() - offset, offset);
+        ++syscalls;
+
+        if (num_read < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (num_read < 0) {
+            return false;
+        }
+
+        if (num_read == 0) {
+            content.resize(offset);
+            break;
+        }
+
+        offset += static_cast<size_t>(num_read);
+    }
+
+    return true;
+}
+
+}  // namespace
+
+bool operator==(const file_status &lhs, const file_status &rhs) {
+    return lhs.is_directory == rhs.is_directory && lhs.is_regular_file == rhs.is_regular_file &&
+           lhs.size == rhs.size && lhs.modification_time == rhs.modification_time;
+}
+
+bool operator!=(const file_status &lhs, const file_status &rhs) { return !(lhs == rhs); }
+
+#ifdef DAMNFLAGS_HAS_IO_URING
+
+// The submission and completion rings of one io_uring instance, mapped into this process
+class io_uring_queue final {
+   public:
+    static std::unique_ptr<io_uring_queue> create(unsigned int entries) {
+        io_uring_params params{};
+        const int ring_fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+
+        if (ring_fd < 0) {
+            return nullptr;
+        }
+
+        auto queue = std::unique_ptr<io_uring_queue>(new io_uring_queue(ring_fd));
+
+        if (!queue->map(params) || !queue->supports_used_operations()) {
+            return nullptr;
+        }
+
+        return queue;
+    }
+
+    io_uring_queue(const io_uring_queue &other) = delete;
+    io_uring_queue &operator=(const io_uring_queue &other) = delete;
+
+    ~io_uring_queue() {
+        if (m_sqes != MAP_FAILED) {
+            munmap(m_sqes, m_sqes_size);
+        }
+
+        if (m_cq_ring != MAP_FAILED && m_cq_ring != m_sq_ring) {
+            munmap(m_cq_ring, m_cq_ring_size);
+        }
+
+        if (m_sq_ring != MAP_FAILED) {
+            munmap(m_sq_ring, m_sq_ring_size);
+        }
+
+        close(m_ring_fd);
+    }
+
+    unsigned int capacity() const { return m_sq_entries; }
+
+    // Only valid until submit_and_wait, at most capacity() at once
+    io_uring_sqe &next_sqe() {
+        const unsigned int index = m_sq_tail_local & *m_sq_mask;
+        io_uring_sqe &sqe = m_sqes[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        m_sq_array[index] = index;
+        ++m_sq_tail_local;
+        ++m_pending;
+
+        return sqe;
+    }
+
+    // Submits the queued requests and waits until all of them completed, func gets user_data and the result of each.
+    // Returns false if not all of them could be submitted, the queue can't be used anymore then.
+    template<typename Func>
+    bool submit_and_wait(uint64_t &syscalls, Func func) {
+        __atomic_store_n(m_sq_tail, m_sq_tail_local, __ATOMIC_RELEASE);
+        unsigned int to_submit = m_pending;
+        unsigned int to_complete = m_pending;
+        bool failed = false;
+        m_pending = 0;
+
+        while (to_complete > 0) {
+            const int result = static_cast<int>(
+                syscall(__NR_io_uring_enter, m_ring_fd, to_submit, to_complete, IORING_ENTER_GETEVENTS, nullptr, 0));
+            ++syscalls;
+
+            // The submitted requests still write into their buffers, so their completions are waited for. Only if
+            // that fails as well they are left behind.
+            if (result < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                if (failed || to_complete == to_submit) {
+                    return false;
+                }
+
+                failed = true;
+                to_complete -= to_submit;
+                to_submit = 0;
+                continue;
+            }
+
+            to_submit -= result > 0 ? std::min<unsigned int>(static_cast<unsigned int>(result), to_submit) : 0;
+
+            unsigned int head = *m_cq_head;
+            const unsigned int tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+
+            for (; head != tail; ++head, --to_complete) {
+                const io_uring_cqe &cqe = m_cqes[head & *m_cq_mask];
+                func(cqe.user_data, cqe.res);
+            }
+
+            __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+        }
+
+        return !failed;
+    }
+
+   private:
+    explicit io_uring_queue(int ring_fd) : m_ring_fd(ring_fd) {}
+
+    bool map(const io_uring_params &params) {
+        m_sq_entries = params.sq_entries;
+        m_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+        m_cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+
+        // Newer kernels map both rings at once
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            m_sq_ring_size = m_cq_ring_size = std::max(m_sq_ring_size, m_cq_ring_size);
+        }
+
+        m_sq_ring = mmap(nullptr, m_sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd,
+                         IORING_OFF_SQ_RING);
+        m_cq_ring = (params.features & IORING_FEAT_SINGLE_MMAP)
+                        ? m_sq_ring
+                        : mmap(nullptr, m_cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                               m_ring_fd, IORING_OFF_CQ_RING);
+        m_sqes = static_cast<io_uring_sqe *>(mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE,
+                                                  MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQES));
+
+        if (m_sq_ring == MAP_FAILED || m_cq_ring == MAP_FAILED || m_sqes == MAP_FAILED) {
+            return false;
+        }
+
+        auto sq_ring = static_cast<char *>(m_sq_ring);
+        auto cq_ring = static_cast<char *>(m_cq_ring);
+        m_sq_tail = reinterpret_cast<unsigned int *>(sq_ring + params.sq_off.tail);
+        m_sq_mask = reinterpret_cast<unsigned int *>(sq_ring + params.sq_off.ring_mask);
+        m_sq_array = reinterpret_cast<unsigned int *>(sq_ring + params.sq_off.array);
+        m_cq_head = reinterpret_cast<unsigned int *>(cq_ring + params.cq_off.head);
+        m_cq_tail = reinterpret_cast<unsigned int *>(cq_ring + params.cq_off.tail);
+        m_cq_mask = reinterpret_cast<unsigned int *>(cq_ring + params.cq_off.ring_mask);
+        m_cqes = reinterpret_cast<io_uring_cqe *>(cq_ring + params.cq_off.cqes);
+        m_sq_tail_local = *m_sq_tail;
+
+        return true;
+    }
+
+    // Kernels from before 5.6 have io_uring, but can't open or stat files with it
+    bool supports_used_operations() const {
+        constexpr unsigned int num_operations = 64;
+        std::vector<char> buffer(sizeof(io_uring_probe) + num_operations * sizeof(io_uring_probe_op), 0);
+        auto probe = reinterpret_cast<io_uring_probe *>(buffer.data());
+
+        if (syscall(__NR_io_uring_register, m_ring_fd, IORING_REGISTER_PROBE, probe, num_operations) < 0) {
+            return false;
+        }
+
+        return std::all_of(std::begin(used_operations), std::end(used_operations), [probe](uint8_t operation) {
+            return operation <= probe->last_op && (probe->ops[operation].flags & IO_URING_OP_SUPPORTED);
+        });
+    }
+
+    static inline constexpr uint8_t used_operations[] = {IORING_OP_STATX, IORING_OP_OPENAT, IORING_OP_READ,
+                                                         IORING_OP_CLOSE};
+
+    int m_ring_fd = -1;
+    unsigned int m_sq_entries = 0;
+    size_t m_sq_ring_size = 0;
+    size_t m_cq_ring_size = 0;
+    size_t m_sqes_size = 0;
+    void *m_sq_ring = MAP_FAILED;
+    void *m_cq_ring = MAP_FAILED;
+    io_uring_sqe *m_sqes = static_cast<io_uring_sqe *>(MAP_FAILED);
+    unsigned int *m_sq_tail = nullptr;
+    unsigned int *m_sq_mask = nullptr;
+    unsigned int *m_sq_array = nullptr;
+    unsigned int *m_cq_head = nullptr;
+    unsigned int *m_cq_tail = nullptr;
+    unsigned int *m_cq_mask = nullptr;
+    io_uring_cqe *m_cqes = nullptr;
+    unsigned int m_sq_tail_local = 0;
+    unsigned int m_pending = 0;
+};
+
+namespace {
+
+constexpr unsigned int statx_mask = STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_MTIME;
+
+void prepare_statx(io_uring_sqe &sqe, const std::string &path, struct statx &result, uint64_t user_data) {
+    sqe.opcode = IORING_OP_STATX;
+    sqe.fd = AT_FDCWD;
+    sqe.addr = reinterpret_cast<uint64_t>(path.c_str());
+    sqe.len = statx_mask;
+    sqe.off = reinterpret_cast<uint64_t>(&result);
+    sqe.user_data = user_data;
+}
+
+file_status status_of(const struct statx &result) {
+    return status_of(result.stx_mode, result.stx_size, result.stx_mtime.tv_sec, result.stx_mtime.tv_nsec);
+}
+
+}  // namespace
+
+#else
+
+class io_uring_queue final {};
+
+#endif
+
+batch_io::batch_io(bool use_io_uring) {
+#ifdef DAMNFLAGS_HAS_IO_URING
+    if (use_io_uring) {
+        m_queue = io_uring_queue::create(queue_depth);
+    }
+#endif
+}
+
+batch_io::batch_io(batch_io &&other) = default;
+
+batch_io::~batch_io() = default;
+
+batch_io &batch_io::operator=(batch_io &&other) = default;
+
+bool batch_io::uses_io_uring() const { return m_queue != nullptr; }
+
+io_statistics batch_io::statistics() const { return m_statistics; }
+
+std::optional<file_status> batch_io::stat_file(const std::string &path) {
+    struct stat result {};
+
+    if (::stat(path.c_str(), &result) != 0) {
+        return std::nullopt;
+    }
+
+    return status_of(result);
+}
+
+std::optional<file_contents> batch_io::read_file(const std::string &path) {
+    batch_io synchronous;
+    return std::move(synchronous.read_synchronously({path}).front());
+}
+
+std::vector<std::optional<file_status>> batch_io::stat(const std::vector<std::string> &paths) {
+    m_statistics.requests += paths.size();
+
+#ifdef DAMNFLAGS_HAS_IO_URING
+    if (m_queue) {
+        std::vector<std::optional<file_status>> results(paths.size());
+        std::vector<struct statx> buffers(std::min<size_t>(paths.size(), m_queue->capacity()));
+
+        for (size_t chunk_begin = 0; chunk_begin < paths.size(); chunk_begin += buffers.size()) {
+            const size_t chunk_end = std::min(chunk_begin + buffers.size(), paths.size());
+
+            for (size_t i = chunk_begin; i < chunk_end; ++i) {
+                prepare_statx(m_queue->next_sqe(), paths[i], buffers[i - chunk_begin], i);
+            }
+
+            const bool submitted = m_queue->submit_and_wait(m_statistics.syscalls, [&](uint64_t index, int result) {
+                if (result == 0) {
+                    results[index] = status_of(buffers[index - chunk_begin]);
+                }
+            });
+
+            if (!submitted) {
+                m_queue.reset();
+                return stat_synchronously(paths);
+            }
+        }
+
+        return results;
+    }
+#endif
+
+    return stat_synchronously(paths);
+}
+
+std::vector<std::optional<file_status>> batch_io::stat_synchronously(const std::vector<std::string> &paths) {
+    std::vector<std::optional<file_status>> results;
+    results.reserve(paths.size());
+
+    for (const auto &current_path : paths) {
+        results.emplace_back(stat_file(current_path));
+        ++m_statistics.syscalls;
+    }
+
+    return results;
+}
+
+std::vector<std::optional<file_contents>> batch_io::read(const std::vector<std::string> &paths) {
+    m_statistics.requests += paths.size();
+
+#ifdef DAMNFLAGS_HAS_IO_URING
+    if (m_queue) {
+        // Open and stat in one batch, then read and close in a second one, every file takes two entries of the queue
+        enum operation : uint64_t { open_file, stat_file, read_file, close_file };
+        constexpr uint64_t num_operations = 4;
+
+        std::vector<std::optional<file_contents>> results(paths.size());
+        const size_t chunk_size = std::min<size_t>(paths.size(), m_queue->capacity() / 2);
+        std::vector<struct statx> buffers(chunk_size);
+        std::vector<int> fds(chunk_size, -1);
+        std::vector<int> read_results(chunk_size, -1);
+
+        for (size_t chunk_begin = 0; chunk_begin < paths.size(); chunk_begin += chunk_size) {
+            const size_t chunk_end = std::min(chunk_begin + chunk_size, paths.size());
+            std::fill(fds.begin(), fds.end(), -1);
+            std::fill(read_results.begin(), read_results.end(), -1);
+
+            for (size_t i = chunk_begin; i < chunk_end; ++i) {
+                auto &open_sqe = m_queue->next_sqe();
+                open_sqe.opcode = IORING_OP_OPENAT;
+                open_sqe.fd = AT_FDCWD;
+                open_sqe.addr = reinterpret_cast<uint64_t>(paths[i].c_str());
+                open_sqe.open_flags = O_RDONLY | O_CLOEXEC;
+                open_sqe.user_data = (i - chunk_begin) * num_operations + open_file;
+
+                prepare_statx(m_queue->next_sqe(), paths[i], buffers[i - chunk_begin],
+                              (i - chunk_begin) * num_operations + stat_file);
+            }
+
+            bool submitted = m_queue->submit_and_wait(m_statistics.syscalls, [&](uint64_t user_data, int result) {
+                const size_t index = user_data / num_operations;
+
+                if (user_data % num_operations == open_file) {
+                    fds[index] = result;
+                } else if (result == 0) {
+                    results[chunk_begin + index] = file_contents{status_of(buffers[index]), {}};
+                }
+            });
+
+            // The close is linked to the read, so it only runs once the read is done
+            for (size_t index = 0; submitted && index < chunk_end - chunk_begin; ++index) {
+                auto &result = results[chunk_begin + index];
+
+                if (fds[index] < 0 || !result || !result->status.is_regular_file) {
+                    result.reset();
+                    continue;
+                }
+
+                result->content.resize(result->status.size);
+
+                auto &read_sqe = m_queue->next_sqe();
+                read_sqe.opcode = IORING_OP_READ;
+                read_sqe.fd = fds[index];
+                read_sqe.addr = reinterpret_cast<uint64_t>(result->content.data());
+                read_sqe.len = static_cast<uint32_t>(result->content.size());
+                read_sqe.off = 0;
+                read_sqe.flags = IOSQE_IO_LINK;
+                read_sqe.user_data = index * num_operations + read_file;
+
+                auto &close_sqe = m_queue->next_sqe();
+                close_sqe.opcode = IORING_OP_CLOSE;
+                close_sqe.fd = fds[index];
+                close_sqe.user_data = index * num_operations + close_file;
+            }
+
+            const auto on_completion = [&](uint64_t user_data, int result) {
+                const size_t index = user_data / num_operations;
+
+                if (user_data % num_operations == read_file) {
+                    read_results[index] = result;
+                } else if (result >= 0) {
+                    fds[index] = -1;
+                }
+            };
+            submitted = submitted && m_queue->submit_and_wait(m_statistics.syscalls, on_completion);
+
+            for (size_t index = 0; index < chunk_end - chunk_begin; ++index) {
+                auto &result = results[chunk_begin + index];
+
+                // Files which changed in between, or a failed read which cancelled the close, are done one by one
+                if (submitted && result &&
+                    static_cast<size_t>(std::max(read_results[index], 0)) != result->content.size()) {
+                    result = read_synchronously({paths[chunk_begin + index]}).front();
+                }
+
+                if (fds[index] >= 0) {
+                    close(fds[index]);
+                    ++m_statistics.syscalls;
+                }
+            }
+
+            if (!submitted) {
+                m_queue.reset();
+                return read_synchronously(paths);
+            }
+        }
+
+        return results;
+    }
+#endif
+
+    return read_synchronously(paths);
+}
+
+std::vector<std::optional<file_contents>> batch_io::read_synchronously(const std::vector<std::string> &paths) {
+    std::vector<std::optional<file_contents>> results;
+    results.reserve(paths.size());
+
+    for (const auto &current_path : paths) {
+        auto &result = results.emplace_back();
+        const int fd = open(current_path.c_str(), O_RDONLY | O_CLOEXEC);
+        ++m_statistics.syscalls;
+
+        if (fd < 0) {
+            continue;
+        }
+
+        struct stat status {};
+
+        if (fstat(fd, &status) == 0 && S_ISREG(status.st_mode)) {
+            file_contents contents{status_of(status), std::string(static_cast<size_t>(status.st_size), '\0')};
+
+            if (read_fully(fd, contents.content, 0, m_statistics.syscalls)) {
+                result = std::move(contents);
+            }
+        }
+
+        close(fd);
+        m_statistics.syscalls += 2;
+    }
+
+    return results;
+}
+
+void batch_io::walk(const fs::path &root,
+                    const std::function<void(const std::string &path, bool is_directory, bool is_regular_file)> &func) {
+    struct unknown_entry final {
+        std::string path;
+        bool is_link = false;
+    };
+
+    std::vector<std::string> level{root.native()};
+    std::vector<std::string> next_level;
+    std::vector<unknown_entry> unknown_entries;
+    std::vector<std::string> unknown_paths;
+
+    while (!level.empty()) {
+        next_level.clear();
+        unknown_entries.clear();
+
+        for (const auto &current_directory : level) {
+            DIR *directory = opendir(current_directory.c_str());
+            ++m_statistics.syscalls;
+
+            if (directory == nullptr) {
+                continue;
+            }
+
+            while (const dirent *entry = readdir(directory)) {
+                const std::string_view name(entry->d_name);
+
+                if (name == "." || name == "..") {
+                    continue;
+                }
+
+                std::string path = current_directory;
+
+                if (path.empty() || path.back() != '/') {
+                    path.push_back('/');
+                }
+
+                path.append(name);
+
+                // Links are reported with the type of their target, but not descended into
+                if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) {
+                    unknown_entries.push_back({std::move(path), entry->d_type == DT_LNK});
+                    continue;
+                }
+
+                func(path, entry->d_type == DT_DIR, entry->d_type == DT_REG);
+
+                if (entry->d_type == DT_DIR) {
+                    next_level.emplace_back(std::move(path));
+                }
+            }
+
+            closedir(directory);
+            ++m_statistics.syscalls;
+        }
+
+        unknown_paths.clear();
+
+        for (const auto &current_entry : unknown_entries) {
+            unknown_paths.push_back(current_entry.path);
+        }
+
+        const auto statuses = stat(unknown_paths);
+
+        for (size_t i = 0; i < unknown_entries.size(); ++i) {
+            const bool is_directory = statuses[i] && statuses[i]->is_directory;
+            func(unknown_entries[i].path, is_directory, statuses[i] && statuses[i]->is_regular_file);
+
+            if (is_directory && !unknown_entries[i].is_link) {
+                next_level.emplace_back(std::move(unknown_entries[i].path));
+            }
+        }
+
+        std::swap(level, next_level);
+    }
+}
@@ -0,0 +1,144 @@
+#include <fstream>
+#include <string>
+
+#include "change_detector.h"
+#include "utils.h"
+
+namespace {
+
+std::string_view without_trailing_separator(std::string_view path) {
+    while (path.size() > 1 && path.back() == '/') {
+        path.remove_suffix(1);
+    }
+
+    return path;
+}
+
+uint64_t path_hash(std::string_view path) { return hash_bytes(without_trailing_separator(path)); }
+
+uint64_t key_hash(uint64_t key) {
+    return hash_bytes(std::string_view(reinterpret_cast<const char *>(&key), sizeof(key)));
+}
+
+}  // namespace
+
+bool operator==(const file_fingerprint &lhs, const file_fingerprint &rhs) {
+    return lhs.size == rhs.size && lhs.content_hash == rhs.content_hash;
+}
+
+bool operator!=(const file_fingerprint &lhs, const file_fingerprint &rhs) { return !(lhs == rhs); }
+
+std::optional<file_fingerprint> change_detector::fingerprint(const fs::path &path,
+                                                             const std::optional<file_fingerprint> &previous) {
+    std::error_code ec;
+    file_fingerprint result;
+
+    result.size = fs::file_size(path, ec);
+    if (ec) {
+        return std::nullopt;
+    }
+
+    result.modification_time = fs::last_write_time(path, ec);
+    if (ec) {
+        return std::nullopt;
+    }
+
+    if (previous && previous->size == result.size && previous->modification_time == result.modification_time) {
+        result.content_hash = previous->content_hash;
+        return result;
+    }
+
+    std::ifstream file_in(path, std::ios::binary);
+
+    if (!file_in) {
+        return std::nullopt;
+    }
+
+    std::string content{std::istreambuf_iterator<char>(file_in), std::istreambuf_iterator<char>()};
+    result.size = content.size();
+    result.content_hash = hash_bytes(content);
+
+    return result;
+}
+
+file_fingerprint change_detector::fingerprint_of_content(std::string_view content) {
+    file_fingerprint result;
+    result.size = content.size();
+    result.content_hash = hash_bytes(content);
+
+    return result;
+}
+
+void change_detector::relevant_file_added(std::string_view path) { m_relevant_files_fingerprint += path_hash(path); }
+
+void change_detector::relevant_file_removed(std::string_view path) { m_relevant_files_fingerprint -= path_hash(path); }
+
+void change_detector::relevant_files_cleared() { m_relevant_files_fingerprint = 0; }
+
+uint64_t change_detector::relevant_files_fingerprint() const { return m_relevant_files_fingerprint; }
+
+void change_detector::working_set_added(uint64_t key) { m_working_set_fingerprint += key_hash(key); }
+
+void change_detector::working_set_removed(uint64_t key) { m_working_set_fingerprint -= key_hash(key); }
+
+bool change_detector::is_up_to_date(const fs::path &input_database) {
+    m_input_fingerprint = fingerprint(input_database, m_input_fingerprint);
+
+    return m_input_fingerprint && m_generated_input && m_generated_relevant_files &&
+           *m_generated_input == *m_input_fingerprint &&
+           *m_generated_relevant_files == m_relevant_files_fingerprint + m_working_set_fingerprint;
+}
+
+void change_detector::input_changed() { m_generated_input.reset(); }
+
+void change_detector::generated() {
+    m_generated_input = m_input_fingerprint;
+    m_generated_relevant_files = m_relevant_files_fingerprint + m_working_set_fingerprint;
+}
+
+bool change_detector::output_changed(const fs::path &output, std::string_view serialized) {
+    auto previous = output == m_output_path ? m_output_fingerprint : std::nullopt;
+    auto current = fingerprint(output, previous);
+
+    return !current || *current != fingerprint_of_content(serialized);
+}
+
+void change_detector::output_written(const fs::path &output, std::string_view serialized) {
+    std::error_code ec;
+    auto written = fingerprint_of_content(serialized);
+    written.modification_time = fs::last_write_time(output, ec);
+
+    m_output_path = output;
+    m_output_fingerprint = written;
+
+    if (ec) {
+        m_output_fingerprint.reset();
+    }
+}
+
+void change_detector::ignore_path(const fs::path &path) { m_ignored_paths.emplace(path.native()); }
+
+bool change_detector::is_self_inflicted(std::string_view path) const {
+    const auto affected_path_view = without_trailing_separator(path);
+
+    if (m_ignored_paths.find(affected_path_view) != m_ignored_paths.cend()) {
+        return true;
+    }
+
+    if (affected_path_view != m_output_path.native() || !m_output_fingerprint) {
+        return false;
+    }
+
+    // Only as long as nobody else changed the output after us
+    const fs::path affected_path(affected_path_view);
+    std::error_code ec;
+    auto size = fs::file_size(affected_path, ec);
+
+    if (ec) {
+        return false;
+    }
+
+    auto modification_time = fs::last_write_time(affected_path, ec);
+
+    return !ec && size == m_output_fingerprint->size && modification_time == m_output_fingerprint->modification_time;
+}
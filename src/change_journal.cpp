@@ -0,0 +1,440 @@
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "change_journal.h"
+#include "logger.h"
+#include "utils.h"
+
+namespace {
+
+// Grows by doubling from here, so appending rarely has to remap
+constexpr size_t initial_capacity = 1024 * 1024;
+
+constexpr std::string_view operation_names[] = {"add", "modify", "remove"};
+
+constexpr std::string_view header_start = "{\"damnflags_journal\":";
+
+// Hashes the strings of the entry directly, which is several times faster than hashing what dump returns
+uint64_t hash_of(const nlohmann::json &value, uint64_t seed) {
+    if (value.is_string()) {
+        return hash_bytes(value.get_ref<const std::string &>(), seed);
+    }
+
+    if (value.is_object()) {
+        for (const auto &[key, item] : value.items()) {
+            seed = hash_of(item, hash_bytes(key, seed));
+        }
+
+        return seed;
+    }
+
+    if (value.is_array()) {
+        for (const auto &item : value) {
+            seed = hash_of(item, seed);
+        }
+
+        // Otherwise ["a"], "b" couldn't be told apart from ["a", "b"]
+        return hash_bytes("]", seed);
+    }
+
+    return hash_bytes(value.dump(), seed);
+}
+
+std::optional<uint64_t> unsigned_field(const nlohmann::json &object, const char *key) {
+    auto result = object.find(key);
+
+    if (result == object.cend() || !result->is_number_unsigned()) {
+        return std::nullopt;
+    }
+
+    return result->get<uint64_t>();
+}
+
+std::optional<journal_operation> operation_of(std::string_view name) {
+    auto result = std::find(std::cbegin(operation_names), std::cend(operation_names), name);
+
+    if (result == std::cend(operation_names)) {
+        return std::nullopt;
+    }
+
+    return static_cast<journal_operation>(result - std::cbegin(operation_names));
+}
+
+// Extends the file with allocated blocks, a write to the mapping of a sparse file would crash on a full disk
+bool extend_file(int fd, size_t offset, size_t length) {
+    if (fallocate(fd, 0, static_cast<off_t>(offset), static_cast<off_t>(length)) == 0) {
+        return true;
+    }
+
+    return errno == EOPNOTSUPP && ftruncate(fd, static_cast<off_t>(offset + length)) == 0;
+}
+
+bool write_all(int fd, std::string_view content) {
+    while (!content.empty()) {
+        const auto written = write(fd, content.data(), content.size());
+
+        if (written < 0 && errno != EINTR) {
+            return false;
+        }
+
+        content.remove_prefix(std::max<ssize_t>(written, 0));
+    }
+
+    return true;
+}
+
+}  // namespace
+
+std::optional<change_journal> change_journal::open(const fs::path &path) {
+    const int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+
+    if (fd == -1) {
+        return std::nullopt;
+    }
+
+    change_journal journal(path, fd);
+    struct stat status {};
+
+    if (fstat(fd, &status) != 0 || !journal.map(std::max(initial_capacity, static_cast<size_t>(status.st_size) * 2))) {
+        return std::nullopt;
+    }
+
+    journal.m_size = static_cast<size_t>(status.st_size);
+
+    if (!journal.load()) {
+        return std::nullopt;
+    }
+
+    return journal;
+}
+
+fs::path change_journal::compaction_path(const fs::path &path) { return path.native() + ".compacting"; }
+
+change_journal::change_journal(const fs::path &path, int fd) : m_path(path), m_fd(fd) {}
+
+change_journal::change_journal(change_journal &&other)
+    : m_path(std::move(other.m_path)),
+      m_fd(std::exchange(other.m_fd, -1)),
+      m_mapping(std::exchange(other.m_mapping, nullptr)),
+      m_capacity(std::exchange(other.m_capacity, 0)),
+      m_size(std::exchange(other.m_size, 0)),
+      m_sequence(other.m_sequence),
+      m_discarded_through(other.m_discarded_through),
+      m_num_records(other.m_num_records),
+      m_num_recorded(other.m_num_recorded),
+      m_next_compaction(other.m_next_compaction),
+      m_files(std::move(other.m_files)),
+      m_num_live_files(other.m_num_live_files) {}
+
+change_journal::~change_journal() {
+    unmap();
+
+    if (m_fd != -1) {
+        close(m_fd);
+    }
+}
+
+change_journal &change_journal::operator=(change_journal &&other) {
+    change_journal moved(std::move(other));
+
+    std::swap(m_path, moved.m_path);
+    std::swap(m_fd, moved.m_fd);
+    std::swap(m_mapping, moved.m_mapping);
+    std::swap(m_capacity, moved.m_capacity);
+    std::swap(m_size, moved.m_size);
+    std::swap(m_sequence, moved.m_sequence);
+    std::swap(m_discarded_through, moved.m_discarded_through);
+    std::swap(m_num_records, moved.m_num_records);
+    std::swap(m_num_recorded, moved.m_num_recorded);
+    std::swap(m_next_compaction, moved.m_next_compaction);
+    std::swap(m_files, moved.m_files);
+    std::swap(m_num_live_files, moved.m_num_live_files);
+
+    return *this;
+}
+
+uint64_t change_journal::sequence() const { return m_sequence; }
+
+size_t change_journal::num_records() const { return m_num_records; }
+
+size_t change_journal::num_recorded() const { return m_num_recorded; }
+
+bool change_journal::record(const nlohmann::json &database, size_t first_entry) {
+    // Every entry of a file goes into its hash, files can be compiled more than once
+    std::unordered_map<std::string_view, uint64_t> hashes;
+    std::vector<std::string_view> files;
+
+    for (size_t i = first_entry; i < database.size(); ++i) {
+        const auto file = string_member(database[i], "file");
+
+        if (file.empty()) {
+            continue;
+        }
+
+        auto [hash, inserted] = hashes.try_emplace(file, 0);
+
+        if (inserted) {
+            files.push_back(file);
+        }
+
+        hash->second = hash_of(database[i], hash->second);
+    }
+
+    // Applied only once they were written, so a failed write is retried with the next call
+    std::vector<std::pair<std::string_view, file_state>> changes;
+
+    for (const auto file : files) {
+        const auto previous = m_files.find(std::string(file));
+        const auto hash = hashes[file];
+        const bool is_live = previous != m_files.cend() && previous->second.operation != journal_operation::remove;
+
+        if (is_live && previous->second.hash == hash) {
+            continue;
+        }
+
+        const auto operation = is_live ? journal_operation::modify : journal_operation::add;
+        changes.emplace_back(file, file_state{hash, m_sequence + changes.size() + 1, operation});
+    }
+
+    if (first_entry == 0) {
+        std::vector<std::string_view> removed_files;
+
+        for (const auto &[file, state] : m_files) {
+            if (state.operation != journal_operation::remove && hashes.count(file) == 0) {
+                removed_files.push_back(file);
+            }
+        }
+
+        std::sort(removed_files.begin(), removed_files.end());
+
+        for (const auto file : removed_files) {
+            changes.emplace_back(file, file_state{0, m_sequence + changes.size() + 1, journal_operation::remove});
+        }
+    }
+
+    std::string lines;
+
+    for (const auto &[file, state] : changes) {
+        append_record(lines, file, state);
+    }
+
+    m_num_recorded = 0;
+
+    if (!append(lines)) {
+        return false;
+    }
+
+    for (const auto &[file, state] : changes) {
+        update_file(file, state);
+    }
+
+    m_sequence += changes.size();
+    m_num_records += changes.size();
+    m_num_recorded = changes.size();
+
+    if (m_num_records >= m_next_compaction && m_num_records > 2 * m_num_live_files) {
+        if (compact()) {
+            m_next_compaction = min_records_to_compact;
+        } else {
+            // The changes are in the journal either way, so it only grows until the next try
+            m_next_compaction = 2 * m_num_records;
+            logger::instance()->log_warning("Couldn't compact the change journal " + m_path.string() +
+                                            ", trying again at " + std::to_string(m_next_compaction) + " records");
+        }
+    }
+
+    return true;
+}
+
+bool change_journal::load() {
+    const std::string_view content(m_mapping, m_size);
+    size_t valid_size = 0;
+    bool has_header = false;
+
+    // Something else which happens to have the same name isn't overwritten, an empty journal or an interrupted write
+    // of the header are started over
+    if (content.substr(0, header_start.size()) != header_start.substr(0, content.size())) {
+        return false;
+    }
+
+    for (size_t line_end; (line_end = content.find('\n', valid_size)) != std::string_view::npos;
+         valid_size = line_end + 1) {
+        const auto line = nlohmann::json::parse(content.cbegin() + valid_size, content.cbegin() + line_end, nullptr,
+                                                false);
+
+        if (!has_header) {
+            if (line.is_discarded() || unsigned_field(line, "damnflags_journal") != uint64_t{format_version}) {
+                return false;
+            }
+
+            m_discarded_through = unsigned_field(line, "discarded_through").value_or(0);
+            has_header = true;
+            continue;
+        }
+
+        if (line.is_discarded()) {
+            break;
+        }
+
+        const auto sequence = unsigned_field(line, "seq");
+        const auto operation = operation_of(string_member(line, "op"));
+        const auto file = string_member(line, "file");
+
+        if (!sequence || !operation || file.empty()) {
+            break;
+        }
+
+        const auto hash = std::strtoull(std::string(string_member(line, "hash")).c_str(), nullptr, 16);
+        update_file(file, file_state{hash, *sequence, *operation});
+        m_sequence = std::max(m_sequence, *sequence);
+        ++m_num_records;
+    }
+
+    // The rest was cut off by an interrupted write
+    if (valid_size != m_size) {
+        if (ftruncate(m_fd, static_cast<off_t>(valid_size)) != 0) {
+            return false;
+        }
+
+        m_size = valid_size;
+    }
+
+    return has_header || append(header(m_discarded_through));
+}
+
+bool change_journal::append(std::string_view lines) {
+    if (lines.empty()) {
+        return true;
+    }
+
+    const size_t new_size = m_size + lines.size();
+
+    if (new_size > m_capacity && !map(std::max(new_size, m_capacity * 2))) {
+        return false;
+    }
+
+    if (!extend_file(m_fd, m_size, lines.size())) {
+        return false;
+    }
+
+    std::memcpy(m_mapping + m_size, lines.data(), lines.size());
+    m_size = new_size;
+
+    return true;
+}
+
+bool change_journal::map(size_t capacity) {
+    // The mapping can be larger than the file, only the part up to its end is ever touched
+    void *mapping = m_mapping != nullptr ? mremap(m_mapping, m_capacity, capacity, MREMAP_MAYMOVE)
+                                         : mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+
+    m_mapping = static_cast<char *>(mapping);
+    m_capacity = capacity;
+
+    return true;
+}
+
+void change_journal::unmap() {
+    if (m_mapping != nullptr) {
+        munmap(m_mapping, m_capacity);
+        m_mapping = nullptr;
+        m_capacity = 0;
+    }
+}
+
+bool change_journal::compact() {
+    std::vector<const std::pair<const std::string, file_state> *> live_files;
+    uint64_t discarded_through = m_discarded_through;
+
+    for (const auto &current_file : m_files) {
+        if (current_file.second.operation == journal_operation::remove) {
+            discarded_through = std::max(discarded_through, current_file.second.sequence);
+        } else {
+            live_files.push_back(&current_file);
+        }
+    }
+
+    std::sort(live_files.begin(), live_files.end(),
+              [](const auto *lhs, const auto *rhs) { return lhs->second.sequence < rhs->second.sequence; });
+
+    std::string content = header(discarded_through);
+
+    for (const auto *current_file : live_files) {
+        append_record(content, current_file->first, current_file->second);
+    }
+
+    // Readers see either the old or the compacted journal, never a partially written one
+    const auto tmp_path = compaction_path(m_path);
+    const int fd = ::open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (fd == -1) {
+        return false;
+    }
+
+    if (!write_all(fd, content) || rename(tmp_path.c_str(), m_path.c_str()) != 0) {
+        close(fd);
+        unlink(tmp_path.c_str());
+        return false;
+    }
+
+    unmap();
+    close(m_fd);
+    m_fd = fd;
+    m_size = content.size();
+
+    for (auto it = m_files.begin(); it != m_files.end();) {
+        it = it->second.operation == journal_operation::remove ? m_files.erase(it) : std::next(it);
+    }
+
+    m_discarded_through = discarded_through;
+    m_num_records = live_files.size();
+
+    return map(std::max(initial_capacity, m_size * 2));
+}
+
+void change_journal::update_file(std::string_view file, const file_state &state) {
+    auto &current = m_files[std::string(file)];
+    const bool was_live = current.sequence != 0 && current.operation != journal_operation::remove;
+    const bool is_live = state.operation != journal_operation::remove;
+
+    if (is_live && !was_live) {
+        ++m_num_live_files;
+    } else if (was_live && !is_live) {
+        --m_num_live_files;
+    }
+
+    current = state;
+}
+
+std::string change_journal::header(uint64_t discarded_through) {
+    return "{\"damnflags_journal\":" + std::to_string(format_version) +
+           ",\"discarded_through\":" + std::to_string(discarded_through) + "}\n";
+}
+
+void change_journal::append_record(std::string &lines, std::string_view file, const file_state &state) const {
+    lines.append("{\"seq\":").append(std::to_string(state.sequence)).append(",\"op\":\"");
+    lines.append(operation_names[static_cast<size_t>(state.operation)]).append("\",\"file\":");
+    lines.append(nlohmann::json(file).dump());
+
+    if (state.operation != journal_operation::remove) {
+        char hash[17];
+        std::snprintf(hash, sizeof(hash), "%016" PRIx64, state.hash);
+        lines.append(",\"hash\":\"").append(hash, 16).push_back('"');
+    }
+
+    lines.append("}\n");
+}
@@ -0,0 +1,354 @@
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstring>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+
+#include "command_expander.h"
+#include "utils.h"
+
+namespace {
+
+bool is_response_file(std::string_view argument) { return argument.size() > 1 && argument.front() == '@'; }
+
+// Like the compiler, relative response files are looked up in the directory it runs in. The result is the cache key,
+// so it is normalized the same way as the paths of the events which invalidate it.
+std::string resolved_path(std::string_view file, std::string_view directory) {
+    if (file.front() == '/' || directory.empty()) {
+        return normalized_path(file);
+    }
+
+    std::string result(directory);
+
+    if (result.back() != '/') {
+        result.push_back('/');
+    }
+
+    return normalized_path(result.append(file));
+}
+
+std::string_view store_string(std::pmr::memory_resource *storage, std::string_view value) {
+    auto memory = static_cast<char *>(storage->allocate(value.size(), alignof(char)));
+    std::memcpy(memory, value.data(), value.size());
+    return std::string_view(memory, value.size());
+}
+
+}  // namespace
+
+double expansion_statistics::hit_rate() const {
+    const uint64_t lookups = hits + misses;
+    return lookups == 0 ? 0.0 : static_cast<double>(hits) / static_cast<double>(lookups);
+}
+
+bool command_expander::is_launcher(std::string_view program) {
+    static constexpr std::array<std::string_view, 6> launchers{"ccache", "sccache", "distcc",
+                                                               "icecc",  "icerun",  "buildcache"};
+
+    return std::find(launchers.cbegin(), launchers.cend(), filename_of(program)) != launchers.cend();
+}
+
+void command_expander::split_response_file(std::string_view content, std::vector<std::string> &arguments) {
+    std::string current_argument;
+    bool in_argument = false;
+    char quote = '\0';
+
+    for (size_t i = 0; i < content.size(); ++i) {
+        const char current_char = content[i];
+
+        if (current_char == '\\' && i + 1 < content.size()) {
+            current_argument.push_back(content[++i]);
+            in_argument = true;
+        } else if (quote != '\0') {
+            if (current_char == quote) {
+                quote = '\0';
+            } else {
+                current_argument.push_back(current_char);
+            }
+        } else if (current_char == '\'' || current_char == '"') {
+            quote = current_char;
+            in_argument = true;
+        } else if (std::isspace(static_cast<unsigned char>(current_char))) {
+            if (in_argument) {
+                arguments.emplace_back(std::move(current_argument));
+                current_argument.clear();
+                in_argument = false;
+            }
+        } else {
+            current_argument.push_back(current_char);
+            in_argument = true;
+        }
+    }
+
+    if (in_argument) {
+        arguments.emplace_back(std::move(current_argument));
+    }
+}
+
+void command_expander::expand(std::pmr::vector<std::string_view> &command, std::string_view directory,
+                              std::pmr::memory_resource *storage) {
+    // ccache gcc and distcc ccache gcc both compile with gcc, a launcher on its own is left alone
+    size_t launchers = 0;
+
+    while (launchers + 1 < command.size() && is_launcher(command[launchers])) {
+        ++launchers;
+    }
+
+    if (launchers > 0) {
+        command.erase(command.begin(), command.begin() + launchers);
+        m_launchers_stripped += launchers;
+    }
+
+    if (command.size() <= 1 || std::none_of(command.cbegin() + 1, command.cend(), is_response_file)) {
+        return;
+    }
+
+    std::pmr::vector<std::string_view> arguments(command.cbegin() + 1, command.cend(), storage);
+    command.resize(1);
+    expand_arguments(arguments, directory, storage, command, 0);
+}
+
+void command_expander::expand_arguments(const std::pmr::vector<std::string_view> &arguments,
+                                        std::string_view directory, std::pmr::memory_resource *storage,
+                                        std::pmr::vector<std::string_view> &expanded, size_t depth) {
+    for (const auto &current_argument : arguments) {
+        std::shared_ptr<const response_file> contents;
+
+        if (is_response_file(current_argument) && depth < max_nesting_depth) {
+            contents = load(resolved_path(current_argument.substr(1), directory));
+        }
+
+        if (!contents) {
+            expanded.emplace_back(current_argument);
+            continue;
+        }
+
+        // The cached arguments can be replaced while the views are still in use, so they are copied into storage
+        std::pmr::vector<std::string_view> nested(storage);
+        nested.reserve(contents->arguments.size());
+
+        for (const auto &current_nested : contents->arguments) {
+            nested.emplace_back(store_string(storage, current_nested));
+        }
+
+        expand_arguments(nested, directory, storage, expanded, depth + 1);
+    }
+}
+
+std::shared_ptr<const command_expander::response_file> command_expander::load(const std::string &path) {
+    const uint64_t generation = m_generation;
+
+    {
+        std::shared_lock lock(m_mutex);
+
+        // Counted by the first lookup of the generation already
+        if (auto cached = m_response_files.find(path);
+            cached != m_response_files.end() && cached->second.validated_generation == generation) {
+            return cached->second.contents;
+        }
+    }
+
+    // Checked once per generation, in between only invalidate drops entries
+    const auto status = batch_io::stat_file(path);
+
+    if (!status) {
+        return store_missing(path, generation);
+    }
+
+    {
+        std::unique_lock lock(m_mutex);
+
+        if (auto cached = m_response_files.find(path); cached != m_response_files.end() &&
+                                                        cached->second.contents &&
+                                                        cached->second.contents->status == *status) {
+            if (std::exchange(cached->second.validated_generation, generation) != generation) {
+                ++m_hits;
+            }
+
+            return cached->second.contents;
+        }
+    }
+
+    const auto read = batch_io::read_file(path);
+
+    if (!read) {
+        return store_missing(path, generation);
+    }
+
+    return store(path, *read, generation);
+}
+
+std::shared_ptr<const command_expander::response_file> command_expander::store(const std::string &path,
+                                                                               const file_contents &contents,
+                                                                               uint64_t generation) {
+    auto stored = std::make_shared<response_file>();
+    stored->status = contents.status;
+    split_response_file(contents.content, stored->arguments);
+
+    std::unique_lock lock(m_mutex);
+    auto &cached = m_response_files[path];
+
+    if (cached.validated_generation != generation) {
+        ++m_misses;
+    }
+
+    cached = cache_entry{stored, generation};
+
+    return stored;
+}
+
+std::shared_ptr<const command_expander::response_file> command_expander::store_missing(const std::string &path,
+                                                                                       uint64_t generation) {
+    std::unique_lock lock(m_mutex);
+    auto &cached = m_response_files[path];
+
+    if (cached.validated_generation != generation) {
+        ++m_misses;
+    }
+
+    cached = cache_entry{nullptr, generation};
+
+    return nullptr;
+}
+
+void command_expander::preload(const nlohmann::json &database, unsigned int num_threads, batch_io *io) {
+    if (!database.is_array()) {
+        return;
+    }
+
+    // Many entries share the same response files, so every file is only read once
+    std::vector<std::string> paths;
+    std::unordered_set<std::string> seen_paths;
+    std::pmr::monotonic_buffer_resource arena;
+    std::pmr::vector<std::string_view> parts(&arena);
+
+    for (const auto &current_entry : database) {
+        auto command = string_member(current_entry, "command");
+
+        if (command.find('@') == std::string_view::npos) {
+            continue;
+        }
+
+        parts.clear();
+        split_command(command, parts);
+
+        for (size_t i = 1; i < parts.size(); ++i) {
+            if (!is_response_file(parts[i])) {
+                continue;
+            }
+
+            auto path = resolved_path(parts[i].substr(1), string_member(current_entry, "directory"));
+
+            if (seen_paths.insert(path).second) {
+                paths.emplace_back(std::move(path));
+            }
+        }
+    }
+
+    if (io != nullptr && io->uses_io_uring()) {
+        preload_batched(paths, *io);
+        return;
+    }
+
+    if (num_threads == 0) {
+        num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    const size_t num_workers = std::min<size_t>(num_threads, paths.size());
+    std::vector<std::future<void>> workers;
+
+    for (size_t worker = 0; worker < num_workers; ++worker) {
+        auto load_chunk = [&, worker]() {
+            const size_t chunk_begin = paths.size() * worker / num_workers;
+            const size_t chunk_end = paths.size() * (worker + 1) / num_workers;
+
+            for (size_t i = chunk_begin; i < chunk_end; ++i) {
+                load(paths[i]);
+            }
+        };
+
+        if (worker + 1 == num_workers) {
+            load_chunk();
+        } else {
+            workers.emplace_back(std::async(std::launch::async, load_chunk));
+        }
+    }
+
+    for (auto &current_worker : workers) {
+        current_worker.get();
+    }
+}
+
+void command_expander::preload_batched(const std::vector<std::string> &paths, batch_io &io) {
+    const uint64_t generation = m_generation;
+    const auto statuses = io.stat(paths);
+    std::vector<std::string> changed_paths;
+
+    {
+        std::unique_lock lock(m_mutex);
+
+        for (size_t i = 0; i < paths.size(); ++i) {
+            auto &cached = m_response_files[paths[i]];
+
+            if (cached.validated_generation == generation) {
+                continue;
+            }
+
+            if (!statuses[i]) {
+                cached = cache_entry{nullptr, generation};
+                ++m_misses;
+            } else if (cached.contents && cached.contents->status == *statuses[i]) {
+                cached.validated_generation = generation;
+                ++m_hits;
+            } else {
+                changed_paths.push_back(paths[i]);
+            }
+        }
+    }
+
+    const auto contents = io.read(changed_paths);
+
+    for (size_t i = 0; i < changed_paths.size(); ++i) {
+        if (contents[i]) {
+            store(changed_paths[i], *contents[i], generation);
+        } else {
+            store_missing(changed_paths[i], generation);
+        }
+    }
+}
+
+void command_expander::next_generation() {
+    ++m_generation;
+    m_hits = 0;
+    m_misses = 0;
+    m_launchers_stripped = 0;
+}
+
+bool command_expander::invalidate(std::string_view path) {
+    const auto key = normalized_path(path);
+    std::unique_lock lock(m_mutex);
+    auto cached = m_response_files.find(key);
+
+    if (cached == m_response_files.end()) {
+        return false;
+    }
+
+    m_response_files.erase(cached);
+    return true;
+}
+
+void command_expander::clear() {
+    std::unique_lock lock(m_mutex);
+    m_response_files = {};
+}
+
+expansion_statistics command_expander::statistics() const {
+    expansion_statistics result;
+    result.hits = m_hits;
+    result.misses = m_misses;
+    result.launchers_stripped = m_launchers_stripped;
+
+    return result;
+}
@@ -1,12 +1,21 @@
 #include <algorithm>
+#include <atomic>
 #include <cctype>
 #include <fstream>
+#include <future>
 #include <iostream>
+#include <memory_resource>
+#include <set>
 #include <sstream>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
+#include "batch_io.h"
 #include "compilation_database.h"
 #include "config.h"
+#include "flags.h"
 #include "logger.h"
 #include "utils.h"
 
@@ -20,18 +29,15 @@ std::optional<compilation_database> compilation_database::read_from(const fs::pa
         return std::nullopt;
     }
 
-    std::ifstream compilation_database_in(path);
+    // Read at once with the size from the stat, a stream takes a syscall for every few kilobytes
+    auto read_compilation_database = batch_io::read_file(path.native());
 
-    if (!compilation_database_in) {
+    if (!read_compilation_database) {
         return std::nullopt;
     }
 
     try {
-        std::string read_compilation_database{std::istreambuf_iterator<char>(compilation_database_in),
-                                              std::istreambuf_iterator<char>()};
-        compilation_database_in.close();
-
-        auto result = nlohmann::json::parse(read_compilation_database, nullptr, false);
+        auto result = nlohmann::json::parse(read_compilation_database->content, nullptr, false);
 
         if (result.is_discarded()) {
             return std::nullopt;
@@ -47,13 +53,56 @@ std::optional<compilation_database> compilation_database::read_from(const fs::pa
     return std::nullopt;
 }
 
-compilation_database::compilation_database(nlohmann::json database) : m_database(std::move(database)) {}
+compilation_database::compilation_database(nlohmann::json database)
+    : m_database(std::move(database)), m_num_original_entries(m_database.is_array() ? m_database.size() : 0) {}
 
-void compilation_database::swap(compilation_database &other) noexcept { m_database.swap(other.m_database); }
+void compilation_database::swap(compilation_database &other) noexcept {
+    m_database.swap(other.m_database);
+    std::swap(m_num_original_entries, other.m_num_original_entries);
+}
 
 const nlohmann::json &compilation_database::database() const { return m_database; }
 
-bool compilation_database::write_to(const fs::path &path) const {
+bool compilation_database::write_to(const fs::path &path) const { return write_serialized_to(path, serialize()); }
+
+std::string compilation_database::serialize() const { return m_database.dump(); }
+
+void compilation_database::serialize_appended(std::string &serialized, size_t first_entry) const {
+    if (!m_database.is_array() || serialized.size() < 2 || serialized.back() != ']') {
+        serialized = serialize();
+        return;
+    }
+
+    // The compact form of an array has no whitespace, so the entries are just separated by commas
+    serialized.pop_back();
+
+    for (size_t i = first_entry; i < m_database.size(); ++i) {
+        if (serialized.back() != '[') {
+            serialized.push_back(',');
+        }
+
+        serialized.append(m_database[i].dump());
+    }
+
+    serialized.push_back(']');
+}
+
+std::string compilation_database::serialize_entries(const std::vector<size_t> &indices) const {
+    std::string serialized("[");
+
+    for (auto index : indices) {
+        if (serialized.size() > 1) {
+            serialized.push_back(',');
+        }
+
+        serialized.append(m_database[index].dump());
+    }
+
+    serialized.push_back(']');
+    return serialized;
+}
+
+bool compilation_database::write_serialized_to(const fs::path &path, const std::string &serialized) {
     if (!fs::exists(path) && fs::is_regular_file(path)) {
         return false;
     }
@@ -64,128 +113,371 @@ bool compilation_database::write_to(const fs::path &path) const {
         return false;
     }
 
-    std::ostreambuf_iterator<char> out(compilation_database_out);
-    std::string compilation_database_str = m_database.dump();
-    std::copy(compilation_database_str.cbegin(), compilation_database_str.cend(), out);
+    // One call instead of a character at a time, the database can be tens of megabytes
+    compilation_database_out.write(serialized.data(), static_cast<std::streamsize>(serialized.size()));
 
-    return true;
+    return static_cast<bool>(compilation_database_out);
 }
 
-bool compilation_database::add_missing_files(const std::set<fs::path> &relevant_files, const config &conf) {
-    auto remove_specific_flags = [](const auto &current_flag) -> bool {
-        if (current_flag.size() == 0) {
-            return true;
-        }
+augmentation_options &augmentation_options::num_threads(unsigned int value) {
+    m_num_threads = value;
+    return *this;
+}
 
-        if ((current_flag[0] != '-') || (current_flag.find("-o") == 0) || (current_flag.find("-c") == 0)) {
-            // std::cout << "Erasing : " << current_flag << std::endl;
-            return true;
-        }
+augmentation_options &augmentation_options::cancellation_check(std::function<bool()> value) {
+    m_cancellation_check = std::move(value);
+    return *this;
+}
 
-        return false;
-    };
+unsigned int augmentation_options::num_threads() const {
+    if (m_num_threads == 0) {
+        return std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    return m_num_threads;
+}
+
+augmentation_options &augmentation_options::flag_model(const directory_flag_model *value) {
+    m_flag_model = value;
+    return *this;
+}
 
+augmentation_options &augmentation_options::expander(command_expander *value) {
+    m_expander = value;
+    return *this;
+}
+
+bool augmentation_options::is_cancelled() const { return m_cancellation_check && m_cancellation_check(); }
+
+const directory_flag_model *augmentation_options::flag_model() const { return m_flag_model; }
+
+command_expander *augmentation_options::expander() const { return m_expander; }
+
+bool compilation_database::add_missing_files(const std::vector<fs::path> &relevant_files, const config &conf,
+                                             const augmentation_options &options) {
     if (!m_database.is_array() || m_database.size() < 1) {
         return false;
     }
 
-    // Use multimap for filename collisions
-    std::map<fs::path, nlohmann::json> file_map;
-    std::vector<std::string> common_command;
-    bool added_files = false;
+    // All temporaries of this update are allocated from the arena and released at once, the indices only hold views
+    // into the strings of m_database, which stays unchanged until the new entries are appended
+    constexpr size_t arena_bytes_per_entry = 128;
+    std::pmr::monotonic_buffer_resource arena(m_database.size() * arena_bytes_per_entry);
+
+    const auto &database = m_database;
+    const auto &first_entry = database.front();
+
+    struct stem_match {
+        std::string_view path_wo_extension;
+        size_t index;
+    };
+
+    std::pmr::unordered_map<std::string_view, size_t> path_index(&arena);
+    std::pmr::unordered_map<std::string_view, stem_match> stem_index(&arena);
+    std::pmr::vector<std::string_view> common_command(&arena);
+    std::pmr::vector<const fs::path *> headers(&arena);
+    // The index of the entry to take the flags from for every header, if there is one
+    std::pmr::vector<std::optional<size_t>> donors(&arena);
+
+    path_index.reserve(database.size());
+    stem_index.reserve(database.size());
 
-    auto first_entry = m_database.front();
+    // Launchers and response files hide the actual flags, so they are expanded before anything is filtered
+    std::optional<command_expander> local_expander;
+    command_expander *expander = options.expander();
 
-    if (auto command = first_entry.find("command");
-        command != first_entry.end() || command->type() != nlohmann::json::value_t::string) {
-        common_command = split_command(command->get<std::string>());
+    if (!expander) {
+        expander = &local_expander.emplace();
     }
 
-    if (common_command.size() > 1) {
-        // TODO Filter wrong flags
-        auto new_end = std::remove_if(common_command.begin() + 1, common_command.end(), remove_specific_flags);
+    split_command(string_member(first_entry, "command"), common_command);
+    expander->expand(common_command, string_member(first_entry, "directory"), &arena);
+    // TODO Filter wrong flags
+    remove_specific_flags(common_command);
 
-        if (new_end != common_command.end()) {
-            common_command.erase(new_end, common_command.end());
+    // Entries added by an earlier call aren't donors, so adding more headers to an augmented database gives the same
+    // entries as adding them to the original one
+    for (size_t i = 0; i < m_num_original_entries; ++i) {
+        auto filename = string_member(database[i], "file");
+
+        if (filename.empty()) {
+            continue;
         }
-    }
 
-    for (const auto &current_entry : m_database) {
-        if (auto filename = current_entry.find("file"); filename != current_entry.end()) {
-            auto path_wo_extension = fs::path(filename->get<std::string>()).replace_extension();
-            file_map[path_wo_extension] = current_entry;
+        auto path_wo_extension = without_extension(filename);
+        path_index[path_wo_extension] = i;
+
+        // Same source as before: on filename collisions use the lexicographically smallest path
+        auto [stem, inserted] =
+            stem_index.try_emplace(filename_of(path_wo_extension), stem_match{path_wo_extension, i});
+        if (!inserted && path_wo_extension <= stem->second.path_wo_extension) {
+            stem->second = stem_match{path_wo_extension, i};
         }
     }
 
     for (const auto &current_entry : relevant_files) {
-        if (!is_header_file(current_entry)) {
-            continue;
+        if (is_header_file(current_entry)) {
+            headers.emplace_back(&current_entry);
         }
+    }
 
-        // TODO: For now search for file with the same filename,
-        // later on look for files which include this one and search for the smallest common subset of flags
-        auto filename_wo_extension = fs::path(current_entry).filename().replace_extension();
-        auto result =
-            std::find_if(file_map.cbegin(), file_map.cend(), [&filename_wo_extension](const auto &current_entry) {
-                return current_entry.first.filename() == filename_wo_extension;
-            });
+    const auto get_flags_from = conf.get_flags_from();
+    std::optional<size_t> get_flags_from_index;
 
-        if (result != file_map.cend()) {
-            std::cout << "Getting flags from matching source file : " << result->second["file"].get<std::string>()
-                      << std::endl;
+    if (get_flags_from) {
+        if (auto result = path_index.find(without_extension(*get_flags_from)); result != path_index.cend()) {
+            get_flags_from_index = result->second;
         }
+    }
 
-        if (auto get_flags_from = conf.get_flags_from(); get_flags_from && result == file_map.cend()) {
-            auto new_try = fs::path(*get_flags_from).replace_extension();
-            result = file_map.find(new_try);
-            if (result != file_map.cend()) {
-                std::cout << "Getting flags from file :" << *get_flags_from << std::endl;
-            }
+    // TODO: For now search for file with the same filename,
+    // later on look for files which include this one and search for the smallest common subset of flags
+    donors.reserve(headers.size());
+    for (const auto *current_header : headers) {
+        auto result = stem_index.find(without_extension(filename_of(current_header->native())));
+        donors.emplace_back(result != stem_index.cend() ? std::optional<size_t>(result->second.index)
+                                                        : get_flags_from_index);
+    }
+
+    // Headers without a matching source inherit the flags of the sources in the nearest directory
+    std::optional<directory_flag_model> local_flag_model;
+    const directory_flag_model *flag_model = options.flag_model();
+    const bool needs_flag_model = std::find(donors.cbegin(), donors.cend(), std::nullopt) != donors.cend();
+
+    if (!flag_model && needs_flag_model) {
+        local_flag_model.emplace(conf.flag_aggregation_mode());
+        local_flag_model->update_from(database, expander);
+        flag_model = &*local_flag_model;
+    }
+
+    std::atomic<size_t> inherited_headers{0};
+    std::atomic<size_t> fallback_headers{0};
+    const bool canonicalize = conf.canonicalize_flags();
+
+    // The workers can't share the arena, since it isn't synchronized. flags and command_line are reused between the
+    // entries, so they don't allocate once they are large enough.
+    struct worker_state {
+        std::pmr::monotonic_buffer_resource arena;
+        std::pmr::vector<std::string_view> flags{&arena};
+        std::pmr::string command_line{&arena};
+        // Canonicalized flags by the entry or model node they were taken from
+        std::pmr::unordered_map<const void *, std::pmr::vector<std::string_view>> canonical_flags{&arena};
+    };
+
+    // Fills flags by calling fill, or reuses the canonicalized flags of the same source
+    auto assign_flags = [canonicalize](worker_state &state, const void *source, std::string_view directory,
+                                       auto fill) {
+        if (!canonicalize) {
+            fill(state.flags);
+            return;
         }
 
+        auto [cached, inserted] = state.canonical_flags.try_emplace(source);
+
+        if (inserted) {
+            fill(cached->second);
+            canonicalize_flags(cached->second, directory, &state.arena);
+        }
+
+        state.flags.assign(cached->second.cbegin(), cached->second.cend());
+    };
+
+    // Only reads from the indices and the database, so it can be called from multiple threads at once
+    auto create_entry = [&](size_t header_index, worker_state &state) {
+        auto &flags = state.flags;
+        auto &command_line = state.command_line;
+
+        const auto &current_entry = *headers[header_index];
+        const std::string_view header = current_entry.native();
+        const auto &donor = donors[header_index];
+
+        flags.clear();
+        command_line.clear();
+
         nlohmann::json new_entry;
+        new_entry["file"] = current_entry.native();
+
+        const inherited_flags *inherited = nullptr;
+
+        if (donor) {
+            const auto &donor_entry = database[*donor];
+            new_entry["directory"] = donor_entry["directory"];
+            const auto donor_directory = string_member(donor_entry, "directory");
+            assign_flags(state, &donor_entry, donor_directory, [&](auto &target) {
+                split_command(string_member(donor_entry, "command"), target);
+                expander->expand(target, donor_directory, &state.arena);
+                remove_specific_flags(target);
+            });
+        } else if (inherited = flag_model ? flag_model->lookup(header) : nullptr;
+                   inherited && !inherited->command.empty()) {
+            ++inherited_headers;
+            new_entry["directory"] = inherited->directory;
+            assign_flags(state, inherited, inherited->directory, [&](auto &target) {
+                target.assign(inherited->command.cbegin(), inherited->command.cend());
+            });
+        } else {
+            ++fallback_headers;
+            // TODO Add something different here
+            new_entry["directory"] = first_entry["directory"];
+            assign_flags(state, &common_command, string_member(first_entry, "directory"), [&](auto &target) {
+                target.assign(common_command.cbegin(), common_command.cend());
+            });
+        }
+
+        // So that this header file gets treated as source file to get completion
+        flags.emplace_back("-c");
+        flags.emplace_back(header);
 
-        new_entry["file"] = current_entry;
-        std::vector<std::string> command_as_list;
+        for (const auto &current_flag : flags) {
+            command_line.append(current_flag).push_back(' ');
+        }
+
+        new_entry["command"] = std::string(command_line);
 
-        if (result != file_map.cend()) {
-            new_entry["directory"] = result->second["directory"];
-            auto cpp_command = split_command(result->second["command"].get<std::string>());
+        return new_entry;
+    };
 
-            if (cpp_command.size() > 1) {
-                auto new_end = std::remove_if(cpp_command.begin() + 1, cpp_command.end(), remove_specific_flags);
+    // Every worker creates the entries of one contiguous chunk of headers, so the order of the entries stays the same
+    constexpr size_t cancellation_check_interval = 64;
+    const size_t num_workers = std::min<size_t>(options.num_threads(), headers.size());
+    std::vector<std::vector<nlohmann::json>> created_entries(num_workers);
+    std::vector<std::future<void>> workers;
+    std::atomic<bool> cancelled{false};
+
+    for (size_t worker = 0; worker < num_workers; ++worker) {
+        auto create_chunk = [&, worker]() {
+            const size_t chunk_begin = headers.size() * worker / num_workers;
+            const size_t chunk_end = headers.size() * (worker + 1) / num_workers;
+            auto &chunk_entries = created_entries[worker];
+
+            worker_state state;
+
+            chunk_entries.reserve(chunk_end - chunk_begin);
+            for (size_t i = chunk_begin; i < chunk_end; ++i) {
+                if ((i - chunk_begin) % cancellation_check_interval == 0 && options.is_cancelled()) {
+                    cancelled = true;
+                }
 
-                if (new_end != cpp_command.end()) {
-                    cpp_command.erase(new_end, cpp_command.end());
+                if (cancelled) {
+                    return;
                 }
+
+                chunk_entries.emplace_back(create_entry(i, state));
             }
+        };
 
-            std::copy(cpp_command.cbegin(), cpp_command.cend(), std::back_inserter(command_as_list));
+        if (worker + 1 == num_workers) {
+            create_chunk();
         } else {
-            std::cout << "Couldn't find a match for header " << current_entry << " ... falling back to common flags"
-                      << std::endl;
+            workers.emplace_back(std::async(std::launch::async, create_chunk));
+        }
+    }
 
-            std::copy(common_command.cbegin(), common_command.cend(), std::back_inserter(command_as_list));
+    for (auto &current_worker : workers) {
+        current_worker.get();
+    }
 
-            // TODO Add something different here
-            new_entry["directory"] = first_entry["directory"];
+    if (cancelled) {
+        return false;
+    }
+
+    if (inherited_headers > 0) {
+        logger::instance()->log_info(std::to_string(inherited_headers.load()) +
+                                     " headers inherited the flags of their directory");
+    }
+
+    if (fallback_headers > 0) {
+        logger::instance()->log_info("Couldn't find a match for " + std::to_string(fallback_headers.load()) +
+                                     " headers ... falling back to common flags");
+    }
+
+    m_database.get_ref<nlohmann::json::array_t &>().reserve(database.size() + headers.size());
+    for (auto &current_chunk : created_entries) {
+        for (auto &current_entry : current_chunk) {
+            m_database.emplace_back(std::move(current_entry));
         }
+    }
 
-        // So that this header file gets treated as source file to get completion
-        command_as_list.emplace_back("-c");
-        command_as_list.emplace_back(current_entry);
+    return headers.size() > 0;
+}
 
-        std::ostringstream command_line;
-        std::copy(command_as_list.cbegin(), command_as_list.cend(),
-                  std::ostream_iterator<std::string>(command_line, " "));
+bool compilation_database::share_flag_sets(const fs::path &flag_set_directory) {
+    if (!m_database.is_array()) {
+        return false;
+    }
 
-        // TODO: add log
-        // std::cout << "Command line : " << command_line.str() << std::endl;
-        new_entry["command"] = command_line.str();
+    std::error_code ec;
+    fs::create_directories(flag_set_directory, ec);
 
-        m_database.emplace_back(new_entry);
-        added_files = true;
+    if (ec) {
+        return false;
     }
 
-    return added_files;
+    std::map<uint64_t, std::string> flag_sets;
+    std::set<std::string> used_files;
+    std::pmr::monotonic_buffer_resource arena;
+    std::pmr::vector<std::string_view> parts(&arena);
+    std::string flag_set;
+
+    for (size_t i = m_num_original_entries; i < m_database.size(); ++i) {
+        auto &current_entry = m_database[i];
+
+        // Entries shared by an earlier call only have to keep their response file
+        if (auto arguments = current_entry.find("arguments"); arguments != current_entry.end()) {
+            if (arguments->is_array() && arguments->size() > 1 && (*arguments)[1].is_string()) {
+                used_files.emplace((*arguments)[1].get<std::string>().substr(1));
+            }
+
+            continue;
+        }
+
+        parts.clear();
+        split_command(string_member(current_entry, "command"), parts);
+
+        // The added entries always end with -c and the file
+        if (parts.size() < 3) {
+            continue;
+        }
+
+        flag_set.clear();
+        for (auto it = parts.cbegin() + 1; it != parts.cend() - 2; ++it) {
+            flag_set.append(*it).push_back('\n');
+        }
+
+        auto hash = hash_bytes(flag_set);
+        auto [response_file, inserted] = flag_sets.try_emplace(hash);
+
+        if (inserted) {
+            std::ostringstream name;
+            name << "flags_" << std::hex << hash << ".rsp";
+            response_file->second = (flag_set_directory / name.str()).string();
+
+            // The name is the hash of the content, so existing files don't have to be written again
+            if (!fs::exists(response_file->second) && !write_serialized_to(response_file->second, flag_set)) {
+                return false;
+            }
+        }
+
+        nlohmann::json arguments = {std::string(parts.front()), "@" + response_file->second, "-c",
+                                    std::string(parts.back())};
+
+        current_entry.erase("command");
+        current_entry["arguments"] = std::move(arguments);
+    }
+
+    // Remove the flag sets which aren't used anymore
+    for (const auto &[hash, response_file] : flag_sets) {
+        used_files.emplace(response_file);
+    }
+
+    for (const auto &current_file : fs::directory_iterator(flag_set_directory, ec)) {
+        const auto &path = current_file.path();
+
+        if (path.filename().string().find("flags_") == 0 && path.extension() == ".rsp" &&
+            used_files.count(path.string()) == 0) {
+            fs::remove(path, ec);
+        }
+    }
+
+    return true;
 }
@@ -51,7 +51,7 @@ std::optional<config> config::load_config(const fs::path &config_path) {
 
     auto parsed_config = nlohmann::json::parse(read_config, nullptr, false);
 
-    if (parsed_config == nlohmann::json::value_t::discarded) {
+    if (parsed_config.is_discarded()) {
         return std::nullopt;
     }
 
@@ -64,7 +64,9 @@ void config::update_patterns() {
     m_prepared_blacklist.clear();
     m_prepared_whitelist.clear();
 
-    m_conf[project_root_key] = load_variables(m_conf[project_root_key]);
+    if (auto root = m_conf.find(project_root_key); root != m_conf.end() && root->is_string()) {
+        m_conf[project_root_key] = load_variables(root->get<std::string>());
+    }
 
     try {
         auto blpatterns = blacklist_patterns();
@@ -72,9 +74,8 @@ void config::update_patterns() {
             m_prepared_blacklist.emplace_back(load_variables(current_entry), std::regex::ECMAScript);
         }
 
-        auto wlpatterns = whitelist_patterns();
-        for (const auto &current_entry : wlpatterns) {
-            m_prepared_whitelist.emplace_back(load_variables(current_entry), std::regex::ECMAScript);
+        for (const auto &current_entry : resolved_whitelist_patterns()) {
+            m_prepared_whitelist.emplace_back(current_entry, std::regex::ECMAScript);
         }
     } catch (std::regex_error e) {
         // TODO: improve error handling here and log errors
@@ -99,6 +100,66 @@ config &config::get_flags_from(const std::string &value) {
     return *this;
 }
 
+config &config::flag_inheritance(const std::string &value) {
+    m_conf[flag_inheritance_key] = value;
+    return *this;
+}
+
+config &config::canonicalize_flags(bool value) {
+    m_conf[canonicalize_flags_key] = value;
+    return *this;
+}
+
+config &config::compact_output(bool value) {
+    m_conf[compact_output_key] = value;
+    return *this;
+}
+
+config &config::lazy_augmentation(bool value) {
+    m_conf[lazy_augmentation_key] = value;
+    return *this;
+}
+
+config &config::max_lazy_entries(size_t value) {
+    m_conf[max_lazy_entries_key] = value;
+    return *this;
+}
+
+config &config::sharded_output(bool value) {
+    m_conf[sharded_output_key] = value;
+    return *this;
+}
+
+config &config::merged_output(bool value) {
+    m_conf[merged_output_key] = value;
+    return *this;
+}
+
+config &config::max_memory_mb(size_t value) {
+    m_conf[max_memory_mb_key] = value;
+    return *this;
+}
+
+config &config::max_threads(unsigned int value) {
+    m_conf[max_threads_key] = value;
+    return *this;
+}
+
+config &config::max_regenerations_per_minute(unsigned int value) {
+    m_conf[max_regenerations_per_minute_key] = value;
+    return *this;
+}
+
+config &config::io_uring_backend(bool value) {
+    m_conf[io_uring_backend_key] = value;
+    return *this;
+}
+
+config &config::change_journal(bool value) {
+    m_conf[change_journal_key] = value;
+    return *this;
+}
+
 config &config::whitelist_regex(const std::vector<std::string> &patterns) {
     m_conf[whitelist_patterns_key] = patterns;
     update_patterns();
@@ -142,6 +203,76 @@ std::optional<std::string> config::get_flags_from() const {
     return load_variables(result.value().get<std::string>());
 }
 
+std::optional<std::string> config::flag_inheritance() const {
+    auto result = m_conf.find(flag_inheritance_key);
+
+    if (result == m_conf.cend() || !result.value().is_string()) {
+        return std::nullopt;
+    }
+
+    return result.value().get<std::string>();
+}
+
+flag_aggregation config::flag_aggregation_mode() const {
+    if (flag_inheritance() == "intersection") {
+        return flag_aggregation::intersection;
+    }
+
+    return flag_aggregation::majority;
+}
+
+bool config::boolean_option(const char *key, bool default_value) const {
+    auto result = m_conf.find(key);
+
+    if (result == m_conf.cend() || !result.value().is_boolean()) {
+        return default_value;
+    }
+
+    return result.value().get<bool>();
+}
+
+size_t config::unsigned_option(const char *key, size_t default_value) const {
+    auto result = m_conf.find(key);
+
+    if (result == m_conf.cend() || !result.value().is_number_unsigned()) {
+        return default_value;
+    }
+
+    return result.value().get<size_t>();
+}
+
+bool config::canonicalize_flags() const { return boolean_option(canonicalize_flags_key, false); }
+
+bool config::compact_output() const { return boolean_option(compact_output_key, false); }
+
+bool config::lazy_augmentation() const { return boolean_option(lazy_augmentation_key, false); }
+
+bool config::sharded_output() const { return boolean_option(sharded_output_key, false); }
+
+bool config::merged_output() const { return boolean_option(merged_output_key, false); }
+
+size_t config::max_memory_mb() const { return unsigned_option(max_memory_mb_key, 0); }
+
+unsigned int config::max_threads() const { return static_cast<unsigned int>(unsigned_option(max_threads_key, 0)); }
+
+unsigned int config::max_regenerations_per_minute() const {
+    return static_cast<unsigned int>(unsigned_option(max_regenerations_per_minute_key, 0));
+}
+
+bool config::io_uring_backend() const { return boolean_option(io_uring_backend_key, false); }
+
+bool config::change_journal() const { return boolean_option(change_journal_key, false); }
+
+size_t config::max_lazy_entries() const {
+    auto result = m_conf.find(max_lazy_entries_key);
+
+    if (result == m_conf.cend() || !result.value().is_number_unsigned() || result.value().get<size_t>() == 0) {
+        return default_max_lazy_entries;
+    }
+
+    return result.value().get<size_t>();
+}
+
 const std::vector<std::regex> &config::prepared_blacklist_patterns() const { return m_prepared_blacklist; }
 
 const std::vector<std::regex> &config::prepared_whitelist_patterns() const { return m_prepared_whitelist; }
@@ -176,6 +307,16 @@ std::vector<std::string> config::whitelist_patterns() const {
     return std::move(patterns);
 }
 
+std::vector<std::string> config::resolved_whitelist_patterns() const {
+    auto patterns = whitelist_patterns();
+
+    for (auto &current_pattern : patterns) {
+        current_pattern = load_variables(current_pattern);
+    }
+
+    return patterns;
+}
+
 std::vector<std::string> config::blacklist_patterns() const {
     auto result = m_conf.find(blacklist_patterns_key);
 
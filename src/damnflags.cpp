@@ -0,0 +1,128 @@
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <future>
+#include <thread>
+#include <vector>
+
+#include "damnflags.h"
+#include "resource_budget.h"
+
+namespace {
+
+void collect_relevant_files(const fs::path &directory, const config &conf, std::vector<fs::path> &relevant_files) {
+    std::error_code ec;
+
+    for (auto it = fs::recursive_directory_iterator(directory, ec); !ec && it != fs::recursive_directory_iterator();
+         it.increment(ec)) {
+        if (it->is_regular_file() && workspace::is_relevant_file(*it, conf)) {
+            relevant_files.emplace_back(it->path());
+        }
+    }
+}
+
+// Every top level directory is a separate work item, the workers take the next one until none are left. The result is
+// sorted, so the output doesn't depend on the scheduling of the workers.
+std::vector<fs::path> scan_project(const fs::path &project_path, const config &conf, unsigned int num_threads) {
+    std::vector<fs::path> relevant_files;
+    std::vector<fs::path> directories;
+
+    for (auto &current_entry : fs::directory_iterator(project_path)) {
+        if (current_entry.is_directory()) {
+            directories.emplace_back(current_entry.path());
+        } else if (current_entry.is_regular_file() && workspace::is_relevant_file(current_entry, conf)) {
+            relevant_files.emplace_back(current_entry.path());
+        }
+    }
+
+    const size_t num_workers = std::max<size_t>(std::min<size_t>(num_threads, directories.size()), 1);
+    std::vector<std::vector<fs::path>> worker_results(num_workers);
+    std::vector<std::future<void>> workers;
+    std::atomic<size_t> next_directory{0};
+
+    for (size_t worker = 0; worker < num_workers; ++worker) {
+        workers.emplace_back(std::async(std::launch::async, [&, worker]() {
+            for (size_t i = next_directory++; i < directories.size(); i = next_directory++) {
+                collect_relevant_files(directories[i], conf, worker_results[worker]);
+            }
+        }));
+    }
+
+    for (size_t worker = 0; worker < num_workers; ++worker) {
+        workers[worker].get();
+        relevant_files.insert(relevant_files.end(), std::make_move_iterator(worker_results[worker].begin()),
+                              std::make_move_iterator(worker_results[worker].end()));
+    }
+
+    std::sort(relevant_files.begin(), relevant_files.end(),
+              [](const auto &lhs, const auto &rhs) { return lhs.native() < rhs.native(); });
+
+    return relevant_files;
+}
+
+}  // namespace
+
+generation_result generate_compilation_database(const fs::path &project_path, const std::optional<config> &conf,
+                                                unsigned int num_threads) {
+    auto logger_instance = logger::instance();
+
+    if (!fs::exists(project_path) || !fs::is_directory(project_path)) {
+        logger_instance->log_error("The project path isn't a directory");
+        return generation_result::invalid_project;
+    }
+
+    config resulting_config = workspace::resolve_config(project_path, conf);
+    num_threads = resource_budget(resource_limits::from_config(resulting_config)).worker_threads(num_threads);
+    std::vector<fs::path> relevant_files = scan_project(project_path, resulting_config, num_threads);
+
+    if (!resulting_config.compilation_database_path()) {
+        // Databases written by the sharded output can't be the input
+        const auto generated = workspace::generated_databases(fs::absolute(project_path));
+        auto result =
+            std::find_if(relevant_files.cbegin(), relevant_files.cend(), [&generated](const auto &current_entry) {
+                return current_entry.filename() == compilation_database::database_name &&
+                       generated.count(fs::absolute(current_entry)) == 0;
+            });
+
+        if (result != relevant_files.cend()) {
+            resulting_config.compilation_database_path(fs::absolute(*result));
+        }
+    }
+
+    if (!resulting_config.compilation_database_path()) {
+        logger_instance->log_error("Couldn't find a compilation database in the project");
+        return generation_result::missing_database;
+    }
+
+    auto database = compilation_database::read_from(*resulting_config.compilation_database_path());
+
+    if (!database) {
+        logger_instance->log_error("Couldn't read database");
+        return generation_result::invalid_database;
+    }
+
+    database->add_missing_files(relevant_files, resulting_config, augmentation_options{}.num_threads(num_threads));
+
+    if (resulting_config.compact_output() &&
+        !database->share_flag_sets(project_path / compilation_database::flag_set_directory_name)) {
+        logger_instance->log_error("Couldn't write the shared flag sets");
+        return generation_result::write_failed;
+    }
+
+    auto tmp_file = project_path / "comp_db.json";
+
+    if (!database->write_to(tmp_file)) {
+        logger_instance->log_error("Couldn't write the compilation database");
+        return generation_result::write_failed;
+    }
+
+    std::error_code ec;
+    fs::rename(tmp_file, project_path / compilation_database::database_name, ec);
+
+    if (ec) {
+        logger_instance->log_error("Couldn't move the compilation database into place");
+        return generation_result::write_failed;
+    }
+
+    return generation_result::success;
+}
@@ -0,0 +1,253 @@
+#include <algorithm>
+#include <memory_resource>
+
+#include "command_expander.h"
+#include "directory_flag_model.h"
+#include "flags.h"
+#include "utils.h"
+
+namespace {
+
+// Calls func with every component of the directory the file is in
+template<typename Func>
+void for_each_directory_component(std::string_view file, Func func) {
+    auto separator = file.rfind('/');
+
+    if (separator == std::string_view::npos) {
+        return;
+    }
+
+    auto directory = file.substr(0, separator);
+
+    while (!directory.empty()) {
+        auto component_end = directory.find('/');
+        auto component = directory.substr(0, component_end);
+
+        if (!component.empty() && !func(component)) {
+            return;
+        }
+
+        if (component_end == std::string_view::npos) {
+            return;
+        }
+
+        directory.remove_prefix(component_end + 1);
+    }
+}
+
+template<typename Counts>
+std::string most_common(const Counts &counts) {
+    auto result = std::max_element(counts.cbegin(), counts.cend(),
+                                   [](const auto &lhs, const auto &rhs) { return lhs.second < rhs.second; });
+
+    return result != counts.cend() ? result->first : std::string{};
+}
+
+template<typename Counts>
+void change_count(Counts &counts, std::string_view key, bool add) {
+    auto result = counts.find(key);
+
+    if (add) {
+        if (result == counts.end()) {
+            counts.emplace(std::string(key), 1);
+        } else {
+            ++result->second;
+        }
+    } else if (result != counts.end() && --result->second == 0) {
+        counts.erase(result);
+    }
+}
+
+}  // namespace
+
+directory_flag_model::directory_flag_model(flag_aggregation aggregation) : m_aggregation(aggregation) {}
+
+void directory_flag_model::update_from(const nlohmann::json &database, command_expander *expander) {
+    if (!database.is_array()) {
+        return;
+    }
+
+    ++m_generation;
+
+    for (const auto &current_entry : database) {
+        auto file = string_member(current_entry, "file");
+        auto directory = string_member(current_entry, "directory");
+        auto command = string_member(current_entry, "command");
+
+        if (file.empty() || command.empty()) {
+            continue;
+        }
+
+        auto record = m_entries.find(std::string(file));
+
+        if (record != m_entries.end() && record->second.hash == hash_bytes(command, hash_bytes(directory))) {
+            record->second.generation = m_generation;
+            continue;
+        }
+
+        add_entry(file, directory, command, expander);
+    }
+
+    for (auto it = m_entries.begin(); it != m_entries.end();) {
+        if (it->second.generation != m_generation) {
+            apply(it->first, it->second, false);
+            it = m_entries.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    refresh();
+}
+
+void directory_flag_model::add_entry(std::string_view file, std::string_view directory, std::string_view command,
+                                     command_expander *expander) {
+    remove_entry(file);
+
+    std::pmr::monotonic_buffer_resource arena;
+    std::pmr::vector<std::string_view> parts(&arena);
+    split_command(command, parts);
+
+    if (expander) {
+        expander->expand(parts, directory, &arena);
+    }
+
+    remove_specific_flags(parts);
+
+    if (parts.empty()) {
+        return;
+    }
+
+    entry_record record;
+    record.directory = directory;
+    record.hash = hash_bytes(command, hash_bytes(directory));
+    record.generation = m_generation;
+
+    // Options with a separate value are counted as one unit like "-isystem /usr/include" and every unit counts only
+    // once per source
+    record.command.emplace_back(parts.front());
+
+    for (size_t i = 1; i < parts.size(); ++i) {
+        std::string unit(parts[i]);
+
+        if (takes_separate_argument(parts[i]) && i + 1 < parts.size()) {
+            unit.append(" ").append(parts[++i]);
+        }
+
+        if (std::find(record.command.cbegin() + 1, record.command.cend(), unit) == record.command.cend()) {
+            record.command.emplace_back(std::move(unit));
+        }
+    }
+
+    apply(file, record, true);
+    m_entries.emplace(std::string(file), std::move(record));
+}
+
+void directory_flag_model::remove_entry(std::string_view file) {
+    auto record = m_entries.find(std::string(file));
+
+    if (record == m_entries.end()) {
+        return;
+    }
+
+    apply(file, record->second, false);
+    m_entries.erase(record);
+}
+
+void directory_flag_model::apply(std::string_view file, const entry_record &record, bool add) {
+    auto update_node = [this, &record, add](directory_node &node) {
+        node.dirty = true;
+        node.num_sources += add ? 1 : -1;
+        change_count(node.compiler_counts, record.command.front(), add);
+        change_count(node.directory_counts, record.directory, add);
+
+        for (auto flag = record.command.cbegin() + 1; flag != record.command.cend(); ++flag) {
+            auto position = node.flag_positions.find(*flag);
+
+            if (position == node.flag_positions.cend()) {
+                if (add) {
+                    node.flag_positions.emplace(*flag, node.flag_counts.size());
+                    node.flag_counts.emplace_back(*flag, 1);
+                }
+            } else {
+                node.flag_counts[position->second].second += add ? 1 : -1;
+            }
+        }
+    };
+
+    directory_node *current_node = &m_root;
+    update_node(*current_node);
+
+    for_each_directory_component(file, [&](std::string_view component) {
+        auto child = current_node->children.find(component);
+
+        if (child == current_node->children.end()) {
+            if (!add) {
+                return false;
+            }
+
+            child = current_node->children.emplace(std::string(component), std::make_unique<directory_node>()).first;
+        }
+
+        current_node = child->second.get();
+        update_node(*current_node);
+        return true;
+    });
+}
+
+void directory_flag_model::refresh() { refresh(m_root); }
+
+void directory_flag_model::refresh(directory_node &node) {
+    // Every change marks all ancestors as well, so clean nodes can't have dirty children
+    if (!node.dirty) {
+        return;
+    }
+
+    auto &aggregated = node.aggregated;
+    aggregated.command.clear();
+    aggregated.directory = most_common(node.directory_counts);
+
+    if (node.num_sources > 0) {
+        aggregated.command.emplace_back(most_common(node.compiler_counts));
+    }
+
+    for (const auto &[flag, count] : node.flag_counts) {
+        bool included = m_aggregation == flag_aggregation::intersection ? count == node.num_sources
+                                                                         : count > 0 && count * 2 > node.num_sources;
+
+        if (included) {
+            aggregated.command.emplace_back(flag);
+        }
+    }
+
+    for (auto &[name, child] : node.children) {
+        refresh(*child);
+    }
+
+    node.dirty = false;
+}
+
+const inherited_flags *directory_flag_model::lookup(std::string_view path) const {
+    const directory_node *current_node = &m_root;
+    const inherited_flags *result = m_root.num_sources > 0 ? &m_root.aggregated : nullptr;
+
+    for_each_directory_component(path, [&](std::string_view component) {
+        auto child = current_node->children.find(component);
+
+        if (child == current_node->children.cend()) {
+            return false;
+        }
+
+        current_node = child->second.get();
+
+        if (current_node->num_sources > 0) {
+            result = &current_node->aggregated;
+        }
+
+        return true;
+    });
+
+    return result;
+}
+
+size_t directory_flag_model::num_entries() const { return m_entries.size(); }
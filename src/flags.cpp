@@ -0,0 +1,171 @@
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <initializer_list>
+#include <unordered_set>
+
+#include "filesys.h"
+#include "flags.h"
+
+namespace {
+
+enum struct flag_kind { other, define, include };
+
+struct flag_unit final {
+    flag_kind kind = flag_kind::other;
+    std::string_view option;
+    // Empty if the option doesn't have a value or it's joined
+    std::string_view value;
+};
+
+constexpr std::array<std::string_view, 4> include_options{"-isystem", "-iquote", "-idirafter", "-I"};
+constexpr std::array<std::string_view, 2> define_options{"-D", "-U"};
+
+std::string_view store_string(std::pmr::memory_resource *storage, std::initializer_list<std::string_view> parts) {
+    size_t size = 0;
+    for (const auto &current_part : parts) {
+        size += current_part.size();
+    }
+
+    auto memory = static_cast<char *>(storage->allocate(size, alignof(char)));
+    size_t offset = 0;
+    for (const auto &current_part : parts) {
+        std::memcpy(memory + offset, current_part.data(), current_part.size());
+        offset += current_part.size();
+    }
+
+    return std::string_view(memory, size);
+}
+
+// Splits joined options like -Iinclude or the units of directory_flag_model like "-isystem /usr/include"
+flag_unit classify(std::string_view flag, std::string_view argument) {
+    if (auto separator = flag.find(' '); separator != std::string_view::npos && argument.empty()) {
+        argument = flag.substr(separator + 1);
+        flag = flag.substr(0, separator);
+    }
+
+    for (const auto &current_option : include_options) {
+        if (flag.compare(0, current_option.size(), current_option) == 0) {
+            auto joined = flag.substr(current_option.size());
+            return flag_unit{flag_kind::include, current_option, joined.empty() ? argument : joined};
+        }
+    }
+
+    for (const auto &current_option : define_options) {
+        if (flag.compare(0, current_option.size(), current_option) == 0) {
+            auto joined = flag.substr(current_option.size());
+            return flag_unit{flag_kind::define, current_option, joined.empty() ? argument : joined};
+        }
+    }
+
+    return flag_unit{flag_kind::other, flag, argument};
+}
+
+// Normalizes the path and makes it relative to directory, if that is shorter
+std::string_view canonical_include_path(std::string_view path, std::string_view directory,
+                                        std::pmr::memory_resource *storage) {
+    if (path.empty()) {
+        return path;
+    }
+
+    auto normalized = fs::path(path).lexically_normal();
+
+    if (!normalized.has_filename() && normalized.has_relative_path()) {
+        normalized = normalized.parent_path();
+    }
+
+    if (!directory.empty() && normalized.is_absolute()) {
+        auto relative = normalized.lexically_relative(fs::path(directory));
+
+        if (!relative.empty() && relative.native().size() < normalized.native().size()) {
+            normalized = std::move(relative);
+        }
+    }
+
+    if (normalized.native() == path) {
+        return path;
+    }
+
+    return store_string(storage, {normalized.native()});
+}
+
+}  // namespace
+
+bool takes_separate_argument(std::string_view flag) {
+    static constexpr std::array<std::string_view, 24> _options{
+        "-I",        "-D",         "-U",       "-o",          "-x",           "-isystem",
+        "-iquote",   "-idirafter", "-include", "-imacros",    "-iprefix",     "-iwithprefix",
+        "-isysroot", "-MF",        "-MT",      "-MQ",         "-Xclang",      "-iwithprefixbefore",
+        "-Xlinker",  "-target",    "-arch",    "-Xassembler", "--sysroot",    "-Xpreprocessor"};
+
+    return std::find(_options.cbegin(), _options.cend(), flag) != _options.cend();
+}
+
+void canonicalize_flags(std::pmr::vector<std::string_view> &command, std::string_view directory,
+                        std::pmr::memory_resource *storage) {
+    if (command.size() <= 1) {
+        return;
+    }
+
+    std::pmr::vector<flag_unit> units(storage);
+    units.reserve(command.size());
+
+    for (size_t i = 1; i < command.size(); ++i) {
+        if (takes_separate_argument(command[i]) && i + 1 < command.size()) {
+            units.emplace_back(classify(command[i], command[i + 1]));
+            ++i;
+        } else {
+            units.emplace_back(classify(command[i], {}));
+        }
+    }
+
+    // -DX followed by -UX and -DX again doesn't define the same thing twice, so only deduplicate without -U
+    const bool has_undefines = std::any_of(units.cbegin(), units.cend(), [](const auto &current_unit) {
+        return current_unit.kind == flag_kind::define && current_unit.option == "-U";
+    });
+
+    std::pmr::unordered_set<std::string_view> seen_values(storage);
+    std::pmr::vector<std::string_view> others(storage);
+    std::pmr::vector<std::string_view> defines(storage);
+    std::pmr::vector<std::string_view> includes(storage);
+
+    for (const auto &current_unit : units) {
+        switch (current_unit.kind) {
+            case flag_kind::other:
+                others.emplace_back(current_unit.option);
+                if (!current_unit.value.empty()) {
+                    others.emplace_back(current_unit.value);
+                }
+                break;
+            case flag_kind::define: {
+                auto joined = store_string(storage, {current_unit.option, current_unit.value});
+                if (has_undefines || seen_values.emplace(joined).second) {
+                    defines.emplace_back(joined);
+                }
+                break;
+            }
+            case flag_kind::include: {
+                auto path = canonical_include_path(current_unit.value, directory, storage);
+                // Deduplicate by the kind and the path, -I stays joined while the others keep their separate value
+                auto key = store_string(storage, {current_unit.option, " ", path});
+
+                if (!seen_values.emplace(key).second) {
+                    break;
+                }
+
+                if (current_unit.option == "-I") {
+                    includes.emplace_back(store_string(storage, {current_unit.option, path}));
+                } else {
+                    includes.emplace_back(current_unit.option);
+                    includes.emplace_back(path);
+                }
+                break;
+            }
+        }
+    }
+
+    command.resize(1);
+    command.insert(command.cend(), others.cbegin(), others.cend());
+    command.insert(command.cend(), defines.cbegin(), defines.cend());
+    command.insert(command.cend(), includes.cbegin(), includes.cend());
+}
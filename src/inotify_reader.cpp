@@ -0,0 +1,139 @@
+// clang-format off
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/select.h>
+// clang-format on
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <type_traits>
+
+#include "inotify_reader.h"
+#include "logger.h"
+
+inotify_reader::inotify_reader(int notify_fd)
+    : m_notify_fd(notify_fd), m_wakeup_fd(eventfd(0, EFD_NONBLOCK)), m_stop_fd(eventfd(0, EFD_NONBLOCK)) {}
+
+inotify_reader::~inotify_reader() {
+    if (m_reader_thread.joinable()) {
+        uint64_t stop = 1;
+        write(m_stop_fd, &stop, sizeof(stop));
+        m_reader_thread.join();
+    }
+
+    if (m_wakeup_fd != -1) {
+        close(m_wakeup_fd);
+    }
+
+    if (m_stop_fd != -1) {
+        close(m_stop_fd);
+    }
+}
+
+bool inotify_reader::start() {
+    if (m_wakeup_fd == -1 || m_stop_fd == -1 || m_reader_thread.joinable()) {
+        return false;
+    }
+
+    m_reader_thread = std::thread([this]() { read_events(); });
+    return true;
+}
+
+bool inotify_reader::wait_for_events(std::optional<std::chrono::milliseconds> timeout) {
+    fd_set descriptor_set;
+    FD_ZERO(&descriptor_set);
+    FD_SET(m_wakeup_fd, &descriptor_set);
+
+    timespec timeout_spec{};
+    if (timeout) {
+        timeout_spec.tv_sec = timeout->count() / 1000;
+        timeout_spec.tv_nsec = (timeout->count() % 1000) * 1000000;
+    }
+
+    int ret = pselect(m_wakeup_fd + 1, &descriptor_set, nullptr, nullptr, timeout ? &timeout_spec : nullptr, nullptr);
+
+    if (ret == -1) {
+        perror("Error selecting");
+        return false;
+    }
+
+    if (ret == 0) {
+        return false;
+    }
+
+    uint64_t counter = 0;
+    read(m_wakeup_fd, &counter, sizeof(counter));
+    return true;
+}
+
+std::optional<inotify_record> inotify_reader::next_event() { return m_queue.try_pop(); }
+
+uint64_t inotify_reader::change_generation() const { return m_change_generation.load(std::memory_order_acquire); }
+
+bool inotify_reader::overflowed() { return m_overflowed.exchange(false); }
+
+void inotify_reader::read_events() {
+    constexpr size_t buffer_size = 4096;
+    std::aligned_storage_t<buffer_size, alignof(inotify_event)> aligned_buffer;
+
+    char *as_char_buffer = reinterpret_cast<char *>(&aligned_buffer);
+    const inotify_event *event = nullptr;
+    const int max_fd = std::max(m_notify_fd, m_stop_fd);
+
+    while (1) {
+        fd_set descriptor_set;
+        FD_ZERO(&descriptor_set);
+        FD_SET(m_notify_fd, &descriptor_set);
+        FD_SET(m_stop_fd, &descriptor_set);
+
+        int ret = pselect(max_fd + 1, &descriptor_set, nullptr, nullptr, nullptr, nullptr);
+
+        if (ret == -1 && errno == EINTR) {
+            continue;
+        }
+
+        if (ret == -1 || FD_ISSET(m_stop_fd, &descriptor_set)) {
+            return;
+        }
+
+        bool queued_events = false;
+        bool queued_changes = false;
+
+        while (1) {
+            ssize_t len_read = read(m_notify_fd, as_char_buffer, buffer_size);
+
+            if (len_read <= 0) {
+                break;
+            }
+
+            for (auto it = as_char_buffer; it < as_char_buffer + len_read; it += sizeof(inotify_event) + event->len) {
+                event = reinterpret_cast<const inotify_event *>(it);
+
+                if (event->mask & IN_Q_OVERFLOW) {
+                    m_overflowed = true;
+                    continue;
+                }
+
+                inotify_record record{event->mask, event->wd, event->cookie, event->len ? event->name : ""};
+
+                if (!m_queue.try_push(std::move(record))) {
+                    m_overflowed = true;
+                    continue;
+                }
+
+                queued_events = true;
+                queued_changes = queued_changes || (event->mask & changing_events);
+            }
+        }
+
+        if (queued_changes) {
+            m_change_generation.fetch_add(1, std::memory_order_release);
+        }
+
+        if (queued_events || m_overflowed) {
+            uint64_t wakeup = 1;
+            write(m_wakeup_fd, &wakeup, sizeof(wakeup));
+        }
+    }
+}
@@ -22,8 +22,9 @@ const fs::path &logger_configuration::log_path() const { return m_log_path; }
 std::shared_ptr<logger> logger::instance(const std::optional<logger_configuration> config) {
     std::lock_guard<std::mutex> instance_guard{_instance_mutex};
 
-    if (!_instance && config) {
-        _instance = std::shared_ptr<logger>(new logger(*config));
+    // Fall back to the default configuration, so the library can be used without configuring the logger first
+    if (!_instance) {
+        _instance = std::shared_ptr<logger>(new logger(config.value_or(logger_configuration{})));
     }
 
     return _instance;
@@ -3,13 +3,13 @@
 
 #include "clara.hpp"
 
-#include "config.h"
-#include "logger.h"
-#include "workspace.h"
+#include "damnflags.h"
 
 int main(int argc, char *argv[]) {
     bool log_to_console = false;
     bool generate_config = false;
+    bool run_once = false;
+    unsigned int num_threads = 0;
     std::string config_path = "";
     std::string log_path = "";
     std::string project_root = "";
@@ -18,7 +18,10 @@ int main(int argc, char *argv[]) {
                clara::Opt(config_path, "config_path")["--config"]("Path to the config") |
                clara::Opt(generate_config, "generate_config")["--generate_config"](
                    "Specify to print a config with all possible values to stdout") |
-               clara::Opt(project_root, "project_root")["--project-root"]("Specify the project root");
+               clara::Opt(project_root, "project_root")["--project-root"]("Specify the project root") |
+               clara::Opt(run_once)["--once"](
+                   "Augment the compilation database once, write it and exit instead of watching the project") |
+               clara::Opt(num_threads, "num_threads")["--threads"]("Number of threads to use with --once, 0 uses all");
 
     auto result = cli.parse(clara::Args(argc, argv));
 
@@ -37,12 +40,26 @@ int main(int argc, char *argv[]) {
     auto logger = logger::instance(log_config)->instance();
     auto config = config::load_config(config_path);
 
-    auto config_project_root = config->project_root();
+    std::optional<fs::path> config_project_root;
+
+    if (project_root != "") {
+        config_project_root = fs::absolute(project_root);
+    } else if (config) {
+        config_project_root = config->project_root();
+    }
+
+    const auto resolved_project_root = config_project_root ? *config_project_root : fs::current_path();
+
+    if (run_once) {
+        auto generated = generate_compilation_database(resolved_project_root, config, num_threads);
+        return static_cast<int>(generated);
+    }
 
     auto structure = workspace::discover_project(
-        config_project_root ? *config_project_root : std::filesystem::current_path(), config);
+        resolved_project_root, config,
+        config_path.empty() ? std::nullopt : std::optional<fs::path>(fs::absolute(config_path)));
 
-    logger->log_info(*config_project_root);
+    logger->log_info(resolved_project_root);
 
     if (!structure) {
         logger->log_error("Couldn't start damnflags in the project directory");
@@ -52,11 +69,9 @@ int main(int argc, char *argv[]) {
     std::cout << "Starting damnflags in " << structure->project_root() << std::endl;
 
     while (1) {
-        auto then = std::chrono::steady_clock::now();
-
-        structure->check_for_updates();
-
-        std::this_thread::sleep_until(then + std::chrono::milliseconds{500});
+        // Returns as soon as events arrive, or after the timeout without them, so idle work like the merged database
+        // can be done
+        structure->check_for_updates(std::chrono::milliseconds{500});
     }
 
     return EXIT_SUCCESS;
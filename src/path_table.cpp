@@ -0,0 +1,357 @@
+#include <algorithm>
+
+#include "path_table.h"
+#include "utils.h"
+
+namespace {
+
+template<typename Func>
+void for_each_component(std::string_view path, Func func) {
+    if (!path.empty() && path.front() == '/') {
+        if (!func(std::string_view("/"))) {
+            return;
+        }
+    }
+
+    while (!path.empty()) {
+        auto component_end = path.find('/');
+        auto component = path.substr(0, component_end);
+
+        if (!component.empty() && !func(component)) {
+            return;
+        }
+
+        if (component_end == std::string_view::npos) {
+            return;
+        }
+
+        path.remove_prefix(component_end + 1);
+    }
+}
+
+}  // namespace
+
+path_table::path_table() : m_nodes(1), m_slots(64, invalid_path_id) {}
+
+size_t path_table::find_slot(path_id parent, std::string_view name) const {
+    const size_t mask = m_slots.size() - 1;
+    size_t slot = hash_bytes(name, parent) & mask;
+
+    for (; m_slots[slot] != invalid_path_id; slot = (slot + 1) & mask) {
+        const auto &node = m_nodes[m_slots[slot]];
+
+        if (node.parent == parent && this->name(m_slots[slot]) == name) {
+            break;
+        }
+    }
+
+    return slot;
+}
+
+void path_table::erase_slot(size_t slot) {
+    const size_t mask = m_slots.size() - 1;
+    m_slots[slot] = invalid_path_id;
+
+    // Moves the following entries back into the gap, if it lies between their ideal slot and their current one
+    for (size_t current_slot = (slot + 1) & mask; m_slots[current_slot] != invalid_path_id;
+         current_slot = (current_slot + 1) & mask) {
+        const path_id id = m_slots[current_slot];
+        const size_t ideal_slot = hash_bytes(name(id), m_nodes[id].parent) & mask;
+
+        if (((current_slot - ideal_slot) & mask) >= ((current_slot - slot) & mask)) {
+            m_slots[slot] = id;
+            m_slots[current_slot] = invalid_path_id;
+            slot = current_slot;
+        }
+    }
+}
+
+void path_table::grow_slots() {
+    std::vector<path_id> old_slots(m_slots.size() * 2, invalid_path_id);
+    m_slots.swap(old_slots);
+
+    for (auto id : old_slots) {
+        if (id != invalid_path_id) {
+            m_slots[find_slot(m_nodes[id].parent, name(id))] = id;
+        }
+    }
+}
+
+path_id path_table::intern(path_id parent, std::string_view name) {
+    if (name.empty()) {
+        return parent;
+    }
+
+    size_t slot = find_slot(parent, name);
+
+    if (m_slots[slot] != invalid_path_id) {
+        return m_slots[slot];
+    }
+
+    path_node node;
+    node.parent = parent;
+    node.name_offset = static_cast<uint32_t>(m_names.size());
+    node.name_length = static_cast<uint32_t>(name.size());
+
+    const auto id = static_cast<path_id>(m_nodes.size());
+    m_names.append(name);
+    m_nodes.emplace_back(node);
+    m_slots[slot] = id;
+    link(id);
+
+    // Keep the load factor below one half, so the probe sequences stay short
+    if (m_nodes.size() * 2 > m_slots.size()) {
+        grow_slots();
+    }
+
+    return id;
+}
+
+path_id path_table::intern(std::string_view path) {
+    path_id current_id = root_id;
+
+    for_each_component(path, [&](std::string_view component) {
+        current_id = intern(current_id, component);
+        return true;
+    });
+
+    return current_id;
+}
+
+void path_table::link(path_id id) {
+    auto &parent_node = m_nodes[m_nodes[id].parent];
+    m_nodes[id].next_sibling = parent_node.first_child;
+    parent_node.first_child = id;
+}
+
+void path_table::unlink(path_id id) {
+    auto *current_id = &m_nodes[m_nodes[id].parent].first_child;
+
+    while (*current_id != id) {
+        current_id = &m_nodes[*current_id].next_sibling;
+    }
+
+    *current_id = m_nodes[id].next_sibling;
+    m_nodes[id].next_sibling = invalid_path_id;
+}
+
+void path_table::rename(path_id id, path_id new_parent, std::string_view new_name) {
+    if (id == root_id || new_name.empty()) {
+        return;
+    }
+
+    if (auto existing_slot = find_slot(new_parent, new_name); m_slots[existing_slot] != invalid_path_id) {
+        const path_id existing_id = m_slots[existing_slot];
+
+        if (existing_id == id) {
+            return;
+        }
+
+        erase_slot(existing_slot);
+        unlink(existing_id);
+    }
+
+    erase_slot(find_slot(m_nodes[id].parent, name(id)));
+    unlink(id);
+
+    auto &node = m_nodes[id];
+    node.parent = new_parent;
+
+    // The old name stays in m_names, renames are rare enough that this doesn't matter
+    if (name(id) != new_name) {
+        node.name_offset = static_cast<uint32_t>(m_names.size());
+        node.name_length = static_cast<uint32_t>(new_name.size());
+        m_names.append(new_name);
+    }
+
+    m_slots[find_slot(new_parent, new_name)] = id;
+    link(id);
+}
+
+path_id path_table::find(path_id parent, std::string_view name) const {
+    if (name.empty()) {
+        return parent;
+    }
+
+    return m_slots[find_slot(parent, name)];
+}
+
+path_id path_table::find(std::string_view path) const {
+    path_id current_id = root_id;
+
+    for_each_component(path, [&](std::string_view component) {
+        current_id = find(current_id, component);
+        return current_id != invalid_path_id;
+    });
+
+    return current_id;
+}
+
+path_id path_table::parent(path_id id) const { return m_nodes[id].parent; }
+
+std::string_view path_table::name(path_id id) const {
+    const auto &node = m_nodes[id];
+    return std::string_view(m_names).substr(node.name_offset, node.name_length);
+}
+
+bool path_table::is_within(path_id id, path_id ancestor) const {
+    for (; id != root_id; id = m_nodes[id].parent) {
+        if (id == ancestor) {
+            return true;
+        }
+    }
+
+    return ancestor == root_id;
+}
+
+bool path_table::separated_from_parent(const path_node &node) const {
+    return node.parent != root_id && !(m_nodes[node.parent].name_length == 1 && name(node.parent) == "/");
+}
+
+void path_table::write_path(path_id id, std::string &buffer) const {
+    size_t length = 0;
+
+    for (auto current_id = id; current_id != root_id; current_id = m_nodes[current_id].parent) {
+        const auto &node = m_nodes[current_id];
+        length += node.name_length + (separated_from_parent(node) ? 1 : 0);
+    }
+
+    // Filled from the back, so the ancestors don't have to be collected first
+    buffer.resize(length);
+
+    for (auto current_id = id; current_id != root_id; current_id = m_nodes[current_id].parent) {
+        const auto &node = m_nodes[current_id];
+        length -= node.name_length;
+        buffer.replace(length, node.name_length, name(current_id));
+
+        if (separated_from_parent(node)) {
+            buffer[--length] = '/';
+        }
+    }
+}
+
+fs::path path_table::path(path_id id) const {
+    std::string buffer;
+    write_path(id, buffer);
+    return fs::path(std::move(buffer));
+}
+
+size_t path_table::size() const { return m_nodes.size(); }
+
+size_t path_table::memory_usage() const {
+    return m_nodes.capacity() * sizeof(path_node) + m_names.capacity() + m_slots.capacity() * sizeof(path_id);
+}
+
+bool path_id_set::insert(path_id id) {
+    const size_t word_index = id / 64;
+    const uint64_t bit = uint64_t(1) << (id % 64);
+
+    if (word_index >= m_words.size()) {
+        m_words.resize(std::max(word_index + 1, m_words.size() * 2));
+    }
+
+    if (m_words[word_index] & bit) {
+        return false;
+    }
+
+    m_words[word_index] |= bit;
+    ++m_size;
+    return true;
+}
+
+bool path_id_set::erase(path_id id) {
+    if (!contains(id)) {
+        return false;
+    }
+
+    m_words[id / 64] &= ~(uint64_t(1) << (id % 64));
+    --m_size;
+    return true;
+}
+
+bool path_id_set::contains(path_id id) const {
+    const size_t word_index = id / 64;
+    return word_index < m_words.size() && (m_words[word_index] & (uint64_t(1) << (id % 64))) != 0;
+}
+
+void path_id_set::clear() {
+    m_words.clear();
+    m_size = 0;
+}
+
+size_t path_id_set::size() const { return m_size; }
+
+path_lru::path_lru(size_t capacity) : m_capacity(capacity) {}
+
+bool path_lru::touch(path_id id) {
+    if (id >= m_links.size()) {
+        m_links.resize(std::max<size_t>(id + 1, m_links.size() * 2));
+    }
+
+    const bool inserted = !m_links[id].contained;
+
+    if (inserted) {
+        m_links[id].contained = true;
+        ++m_size;
+    } else if (id == m_newest) {
+        return false;
+    } else {
+        unlink(id);
+    }
+
+    m_links[id].newer = invalid_path_id;
+    m_links[id].older = m_newest;
+
+    if (m_newest != invalid_path_id) {
+        m_links[m_newest].newer = id;
+    } else {
+        m_oldest = id;
+    }
+
+    m_newest = id;
+    return inserted;
+}
+
+path_id path_lru::evict_excess() {
+    if (m_size <= m_capacity) {
+        return invalid_path_id;
+    }
+
+    const path_id evicted = m_oldest;
+    erase(evicted);
+    return evicted;
+}
+
+bool path_lru::erase(path_id id) {
+    if (!contains(id)) {
+        return false;
+    }
+
+    unlink(id);
+    m_links[id].contained = false;
+    --m_size;
+    return true;
+}
+
+void path_lru::unlink(path_id id) {
+    auto &links = m_links[id];
+    (links.newer != invalid_path_id ? m_links[links.newer].older : m_newest) = links.older;
+    (links.older != invalid_path_id ? m_links[links.older].newer : m_oldest) = links.newer;
+    links.newer = invalid_path_id;
+    links.older = invalid_path_id;
+}
+
+bool path_lru::contains(path_id id) const { return id < m_links.size() && m_links[id].contained; }
+
+void path_lru::clear() {
+    m_links.clear();
+    m_newest = invalid_path_id;
+    m_oldest = invalid_path_id;
+    m_size = 0;
+}
+
+size_t path_lru::size() const { return m_size; }
+
+void path_lru::capacity(size_t value) { m_capacity = value; }
+
+size_t path_lru::capacity() const { return m_capacity; }
@@ -0,0 +1,97 @@
+#include <algorithm>
+#include <fstream>
+#include <thread>
+
+#include <unistd.h>
+
+#include "config.h"
+#include "resource_budget.h"
+
+namespace {
+
+std::string with_budget(const std::string &used, size_t budget, const std::string &budget_text) {
+    return budget == 0 ? used + " (no budget)" : used + " of " + budget_text;
+}
+
+std::string mebibytes(size_t bytes) { return std::to_string(bytes / (1024 * 1024)) + " MiB"; }
+
+}  // namespace
+
+resource_limits resource_limits::from_config(const config &conf) {
+    resource_limits limits;
+    limits.max_memory_bytes = conf.max_memory_mb() * 1024 * 1024;
+    limits.max_threads = conf.max_threads();
+    limits.max_regenerations_per_minute = conf.max_regenerations_per_minute();
+
+    return limits;
+}
+
+resource_budget::resource_budget(const resource_limits &limits) : m_limits(limits) {}
+
+std::optional<size_t> resource_budget::resident_memory() {
+    // The second field is the resident set in pages
+    std::ifstream statm_in("/proc/self/statm");
+    size_t total_pages = 0;
+    size_t resident_pages = 0;
+
+    if (!(statm_in >> total_pages >> resident_pages)) {
+        return std::nullopt;
+    }
+
+    return resident_pages * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+void resource_budget::limits(const resource_limits &limits) { m_limits = limits; }
+
+const resource_limits &resource_budget::limits() const { return m_limits; }
+
+unsigned int resource_budget::worker_threads(unsigned int requested) const {
+    if (requested == 0) {
+        requested = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    return m_limits.max_threads == 0 ? requested : std::min(requested, m_limits.max_threads);
+}
+
+bool resource_budget::memory_exceeded() {
+    if (auto resident = resident_memory(); resident.has_value()) {
+        m_resident_memory = *resident;
+    }
+
+    return m_limits.max_memory_bytes != 0 && m_resident_memory > m_limits.max_memory_bytes;
+}
+
+std::chrono::milliseconds resource_budget::regeneration_delay(clock::time_point now) {
+    expire_regenerations(now);
+
+    if (m_limits.max_regenerations_per_minute == 0 || m_regenerations.size() < m_limits.max_regenerations_per_minute) {
+        return std::chrono::milliseconds(0);
+    }
+
+    // The next one can run once the oldest one left the window
+    auto free_at = m_regenerations[m_regenerations.size() - m_limits.max_regenerations_per_minute] +
+                   regeneration_window;
+
+    return std::chrono::ceil<std::chrono::milliseconds>(free_at - now);
+}
+
+void resource_budget::regenerated(clock::time_point now) {
+    expire_regenerations(now);
+    m_regenerations.push_back(now);
+}
+
+void resource_budget::expire_regenerations(clock::time_point now) {
+    while (!m_regenerations.empty() && m_regenerations.front() + regeneration_window <= now) {
+        m_regenerations.pop_front();
+    }
+}
+
+std::string resource_budget::report() const {
+    return "Memory " + with_budget(mebibytes(m_resident_memory), m_limits.max_memory_bytes,
+                                   mebibytes(m_limits.max_memory_bytes)) +
+           ", threads " + with_budget(std::to_string(worker_threads()), m_limits.max_threads,
+                                      std::to_string(m_limits.max_threads)) +
+           ", regenerations in the last minute " +
+           with_budget(std::to_string(m_regenerations.size()), m_limits.max_regenerations_per_minute,
+                       std::to_string(m_limits.max_regenerations_per_minute));
+}
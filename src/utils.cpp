@@ -1,45 +1,169 @@
-#include <array>
+#include <cctype>
+#include <cstring>
 
+#include "flags.h"
 #include "utils.h"
 
 std::vector<std::string> split_command(const std::string &command_line) {
-    std::vector<std::string> parts;
-    std::string current_part;
-    std::istringstream command_line_input(command_line);
+    std::pmr::vector<std::string_view> parts;
+    split_command(command_line, parts);
 
-    while (std::getline(command_line_input, current_part, ' ')) {
-        auto new_end = std::remove_if(current_part.begin(), current_part.end(),
-                                      [](const auto &current_char) { return std::isspace(current_char); });
+    return {parts.cbegin(), parts.cend()};
+}
+
+void split_command(std::string_view command_line, std::pmr::vector<std::string_view> &parts) {
+    const auto is_space = [](char current_char) { return std::isspace(static_cast<unsigned char>(current_char)); };
+    auto it = command_line.cbegin();
 
-        if (new_end != current_part.cend()) {
-            current_part.erase(new_end);
+    while (it != command_line.cend()) {
+        auto part_begin = std::find_if_not(it, command_line.cend(), is_space);
+        auto part_end = std::find_if(part_begin, command_line.cend(), is_space);
+
+        if (part_begin != part_end) {
+            parts.emplace_back(&*part_begin, part_end - part_begin);
         }
 
-        if (current_part.size() == 0) {
+        it = part_end;
+    }
+}
+
+bool remove_specific_flag(std::string_view current_flag) {
+    if (current_flag.size() == 0) {
+        return true;
+    }
+
+    if ((current_flag[0] != '-') || (current_flag.find("-o") == 0) || (current_flag.find("-c") == 0)) {
+        return true;
+    }
+
+    return false;
+}
+
+void remove_specific_flags(std::pmr::vector<std::string_view> &command) {
+    if (command.size() <= 1) {
+        return;
+    }
+
+    auto kept = command.begin() + 1;
+
+    for (auto it = command.begin() + 1; it != command.end(); ++it) {
+        // Separate values like the path of -isystem /usr/include stay with their option, the one of -o is removed
+        const bool has_value = takes_separate_argument(*it) && it + 1 != command.end();
+
+        if (remove_specific_flag(*it)) {
+            it += has_value ? 1 : 0;
             continue;
         }
-        parts.emplace_back(current_part);
+
+        *kept++ = *it;
+
+        if (has_value) {
+            *kept++ = *++it;
+        }
     }
 
-    return std::move(parts);
+    command.erase(kept, command.end());
 }
 
-void replace_pattern_with(std::string &str, std::string_view to_replace, std::string_view replace_with) {
-    auto result = std::search(str.begin(), str.end(), std::cbegin(to_replace), std::cend(to_replace) - 1);
+std::string_view filename_of(std::string_view path) {
+    auto separator = path.rfind('/');
 
-    if (result == str.cend()) {
-        return;
+    if (separator == std::string_view::npos) {
+        return path;
+    }
+
+    return path.substr(separator + 1);
+}
+
+std::string_view string_member(const nlohmann::json &entry, const char *key) {
+    auto result = entry.find(key);
+
+    if (result == entry.cend() || !result->is_string()) {
+        return {};
+    }
+
+    return result->get_ref<const std::string &>();
+}
+
+std::string normalized_path(std::string_view path) {
+    const auto starts_with = [path](std::string_view prefix) { return path.substr(0, prefix.size()) == prefix; };
+    const auto ends_with = [path](std::string_view suffix) {
+        return path.size() >= suffix.size() && path.substr(path.size() - suffix.size()) == suffix;
+    };
+    const bool is_normal = path.find("//") == std::string_view::npos && path.find("/./") == std::string_view::npos &&
+                           path.find("/../") == std::string_view::npos && !starts_with("./") &&
+                           !starts_with("../") && !ends_with("/.") && !ends_with("/..") && path != "." &&
+                           path != "..";
+
+    return is_normal ? std::string(path) : fs::path(path).lexically_normal().native();
+}
+
+std::string_view without_extension(std::string_view path) {
+    auto filename = filename_of(path);
+    auto dot = filename.rfind('.');
+
+    if (dot == std::string_view::npos || dot == 0 || filename == "..") {
+        return path;
     }
 
-    str.replace(result, result + to_replace.size(), replace_with.cbegin(), replace_with.cend());
+    return path.substr(0, path.size() - (filename.size() - dot));
 }
 
-bool is_source_file(const fs::path &path) {
-    static const std::array<std::string, 4> extensions{".c", ".cxx", ".cpp", ".cc"};
-    return matches_extension(path, extensions.cbegin(), extensions.cend());
+namespace {
+
+uint64_t multiply_mix(uint64_t lhs, uint64_t rhs) {
+    __uint128_t product = static_cast<__uint128_t>(lhs) * rhs;
+    return static_cast<uint64_t>(product) ^ static_cast<uint64_t>(product >> 64);
+}
+
+uint64_t read_word(const char *data) {
+    uint64_t word = 0;
+    std::memcpy(&word, data, sizeof(word));
+    return word;
+}
+
+}  // namespace
+
+uint64_t hash_bytes(std::string_view data, uint64_t seed) {
+    constexpr uint64_t secret[] = {0xa0761d6478bd642full, 0xe7037ed1a0b428dbull, 0x8ebc6af09c88c6e3ull};
+
+    const char *current = data.data();
+    size_t remaining = data.size();
+    uint64_t hash = multiply_mix(seed ^ secret[0], data.size() ^ secret[1]);
+
+    for (; remaining >= 16; current += 16, remaining -= 16) {
+        hash = multiply_mix(read_word(current) ^ secret[1], read_word(current + 8) ^ hash);
+    }
+
+    if (remaining >= 8) {
+        hash = multiply_mix(read_word(current) ^ secret[1], hash ^ secret[2]);
+        current += 8;
+        remaining -= 8;
+    }
+
+    uint64_t tail = 0;
+    std::memcpy(&tail, current, remaining);
+    hash = multiply_mix(tail ^ secret[2], hash ^ remaining);
+
+    return multiply_mix(hash ^ secret[0], data.size() ^ secret[1]);
 }
 
-bool is_header_file(const fs::path &path) {
-    static const std::array<std::string, 3> extensions{".h", ".hxx", ".hpp"};
-    return matches_extension(path, extensions.cbegin(), extensions.cend());
+void replace_pattern_with(std::string &str, std::string_view to_replace, std::string_view replace_with) {
+    auto position = str.find(to_replace);
+
+    if (to_replace.empty() || position == std::string::npos) {
+        return;
+    }
+
+    str.replace(position, to_replace.size(), replace_with);
 }
+
+static_assert(classify_file("src/main.cpp") == file_kind::source);
+static_assert(classify_file("include/workspace.h") == file_kind::header);
+static_assert(classify_file("include/.h") == file_kind::other);
+static_assert(classify_file("include.d/file") == file_kind::other);
+static_assert(classify_file("file.hpp~") == file_kind::other);
+
+bool is_source_file(const fs::path &path) { return classify_file(path.native()) == file_kind::source; }
+
+bool is_header_file(const fs::path &path) { return classify_file(path.native()) == file_kind::header; }
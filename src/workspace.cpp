@@ -1,3 +1,7 @@
+#include <algorithm>
+#include <fstream>
+#include <malloc.h>
+#include <set>
 #include <utility>
 // TODO: remove later
 #include <iostream>
@@ -7,6 +11,72 @@
 #include "utils.h"
 #include "workspace.h"
 
+namespace {
+
+// The paths of the shards which were written, one per line
+std::vector<std::string> read_shard_manifest(const fs::path &project_path) {
+    std::ifstream manifest_in(project_path / compilation_database::flag_set_directory_name /
+                              compilation_database::shard_manifest_name);
+    std::vector<std::string> shards;
+
+    for (std::string line; std::getline(manifest_in, line);) {
+        if (!line.empty()) {
+            shards.emplace_back(std::move(line));
+        }
+    }
+
+    return shards;
+}
+
+// The directory directly below root which contains file, empty if file is directly in root or outside of it
+std::string_view top_level_directory(std::string_view file, std::string_view root) {
+    if (file.size() <= root.size() + 1 || file.compare(0, root.size(), root) != 0 || file[root.size()] != '/') {
+        return {};
+    }
+
+    auto relative = file.substr(root.size() + 1);
+    auto separator = relative.find('/');
+
+    return separator == std::string_view::npos ? std::string_view{} : relative.substr(0, separator);
+}
+
+// Every path matching pattern is in the directory and its name there starts with the prefix, if the pattern begins
+// with an absolute path. Patterns aren't anchored, but that path could only match again below itself.
+std::optional<std::pair<std::string_view, std::string_view>> literal_location_of(std::string_view pattern) {
+    if (!pattern.empty() && pattern.front() == '^') {
+        pattern.remove_prefix(1);
+    }
+
+    // Alternatives can match anywhere
+    if (pattern.empty() || pattern.front() != '/' || pattern.find('|') != std::string_view::npos) {
+        return std::nullopt;
+    }
+
+    const auto literal_end = pattern.find_first_of("\\^$.|?*+()[]{}");
+    auto literal = pattern.substr(0, literal_end);
+
+    // A quantifier makes the character before it optional
+    if (literal_end != std::string_view::npos && std::string_view("?*{").find(pattern[literal_end]) !=
+                                                     std::string_view::npos) {
+        literal.remove_suffix(1);
+    }
+
+    const auto separator = literal.rfind('/');
+
+    if (separator == std::string_view::npos) {
+        return std::nullopt;
+    }
+
+    return std::pair{literal.substr(0, separator), literal.substr(separator + 1)};
+}
+
+bool is_within(std::string_view path, std::string_view directory) {
+    return path.size() >= directory.size() && path.compare(0, directory.size(), directory) == 0 &&
+           (path.size() == directory.size() || path[directory.size()] == '/');
+}
+
+}  // namespace
+
 bool operator&(const workspace_events &lhs, const workspace_events &rhs) {
     return (static_cast<uint32_t>(lhs) & static_cast<uint32_t>(rhs)) != 0;
 }
@@ -14,193 +84,907 @@ bool operator&(const workspace_events &lhs, const workspace_events &rhs) {
 workspace_event::workspace_event(workspace_events event_mask, const fs::path &path)
     : m_event_mask(event_mask), m_affected_path(path) {}
 
+workspace_event::workspace_event(workspace_events event_mask, path_id affected_id, std::string_view path)
+    : m_event_mask(event_mask), m_affected_id(affected_id), m_affected_path_view(path) {}
+
 workspace_events workspace_event::event_mask() const { return m_event_mask; }
 
-const fs::path &workspace_event::affected_path() const { return m_affected_path; }
+const fs::path &workspace_event::affected_path() const {
+    if (!m_affected_path) {
+        m_affected_path = fs::path(m_affected_path_view);
+    }
+
+    return *m_affected_path;
+}
+
+std::string_view workspace_event::affected_path_view() const {
+    // Events created from a fs::path don't have a view, which would dangle once the event is copied
+    return m_affected_path_view.empty() && m_affected_path ? std::string_view(m_affected_path->native())
+                                                           : m_affected_path_view;
+}
 
 std::optional<int> workspace_event::directory_watch() const { return m_directory_watch; }
 
+path_id workspace_event::affected_id() const { return m_affected_id; }
+
 workspace_event &workspace_event::directory_watch(int watch) {
     m_directory_watch = watch;
     return *this;
 }
 
-workspace::workspace(int notify_fd, std::map<int, fs::path> directory_watches, const config &conf)
-    : m_config(conf), m_notify_fd(notify_fd), m_directory_watches(directory_watches) {
+workspace::workspace(int notify_fd, std::map<int, fs::path> directory_watches, const config &conf,
+                     std::optional<fs::path> config_path)
+    : m_config(conf),
+      m_config_path(std::move(config_path)),
+      m_event_reader(std::make_unique<inotify_reader>(notify_fd)),
+      m_active_headers(conf.max_lazy_entries()),
+      m_notify_fd(notify_fd),
+      m_flag_model(conf.flag_aggregation_mode()),
+      m_command_expander(std::make_unique<command_expander>()),
+      m_io(conf.io_uring_backend()),
+      m_budget(resource_limits::from_config(conf)) {
+    if (conf.io_uring_backend() && !m_io.uses_io_uring()) {
+        logger::instance()->log_warning("io_uring isn't available, falling back to reading files one at a time");
+    }
+
+    for (const auto &[directory_watch, path] : directory_watches) {
+        set_directory_watch(directory_watch, m_paths.intern(path.native()));
+    }
+
+    m_change_detector.ignore_path(temporary_database_path());
+    watch_config_file();
     populate_relevant_files();
     update_compilation_database();
     m_event_handlers.emplace_back(default_handler);
+
+    if (!m_event_reader->start()) {
+        logger::instance()->log_error("Couldn't start the thread which reads the inotify events");
+    }
 }
 
 workspace::workspace(workspace &&other)
     : m_config(std::move(other.m_config)),
+      m_config_path(std::move(other.m_config_path)),
+      m_config_id(other.m_config_id),
+      m_event_reader(std::move(other.m_event_reader)),
       m_event_handlers(std::move(other.m_event_handlers)),
-      m_notify_fd(other.m_notify_fd),
+      m_paths(std::move(other.m_paths)),
       m_directory_watches(std::move(other.m_directory_watches)),
-      m_relevant_files(std::move(other.m_relevant_files)) {
+      m_path_watches(std::move(other.m_path_watches)),
+      m_relevant_files(std::move(other.m_relevant_files)),
+      m_active_headers(std::move(other.m_active_headers)),
+      m_event_path(std::move(other.m_event_path)),
+      m_path_buffer(std::move(other.m_path_buffer)),
+      m_pending_moves(std::move(other.m_pending_moves)),
+      m_priority_headers(std::move(other.m_priority_headers)),
+      m_published_headers(std::move(other.m_published_headers)),
+      m_notify_fd(other.m_notify_fd),
+      m_dirty_compilation_database(other.m_dirty_compilation_database),
+      m_rebuild_cancelled(other.m_rebuild_cancelled),
+      m_rebuild_restarts(other.m_rebuild_restarts),
+      m_compilation_database(std::move(other.m_compilation_database)),
+      m_published_serialization(std::move(other.m_published_serialization)),
+      m_shard_hashes(std::move(other.m_shard_hashes)),
+      m_merged_database_stale(other.m_merged_database_stale),
+      m_change_journal(std::move(other.m_change_journal)),
+      m_change_detector(std::move(other.m_change_detector)),
+      m_flag_model(std::move(other.m_flag_model)),
+      m_command_expander(std::move(other.m_command_expander)),
+      m_io(std::move(other.m_io)),
+      m_budget(std::move(other.m_budget)),
+      m_memory_degraded(other.m_memory_degraded),
+      m_deferred_regeneration(other.m_deferred_regeneration) {
     other.m_notify_fd = -1;
 }
 
 workspace::~workspace() {
-    for (const auto &[directory_watch, path] : m_directory_watches) {
-        inotify_rm_watch(m_notify_fd, directory_watch);
+    // The reader thread has to be stopped before the descriptor it reads from is closed
+    m_event_reader.reset();
+
+    if (m_notify_fd == -1) {
+        return;
     }
 
-    if (m_notify_fd != -1) {
-        close(m_notify_fd);
+    for (size_t directory_watch = 0; directory_watch < m_directory_watches.size(); ++directory_watch) {
+        if (m_directory_watches[directory_watch] != invalid_path_id) {
+            inotify_rm_watch(m_notify_fd, static_cast<int>(directory_watch));
+        }
     }
+
+    close(m_notify_fd);
 }
 
 void workspace::swap(workspace &other) {
     using std::swap;
 
     swap(m_config, other.m_config);
+    swap(m_config_path, other.m_config_path);
+    swap(m_config_id, other.m_config_id);
+    swap(m_event_reader, other.m_event_reader);
     swap(m_event_handlers, other.m_event_handlers);
+    swap(m_paths, other.m_paths);
     swap(m_directory_watches, other.m_directory_watches);
+    swap(m_path_watches, other.m_path_watches);
     swap(m_relevant_files, other.m_relevant_files);
+    swap(m_active_headers, other.m_active_headers);
+    swap(m_event_path, other.m_event_path);
+    swap(m_path_buffer, other.m_path_buffer);
+    swap(m_pending_moves, other.m_pending_moves);
+    swap(m_priority_headers, other.m_priority_headers);
+    swap(m_published_headers, other.m_published_headers);
     swap(m_notify_fd, other.m_notify_fd);
+    swap(m_dirty_compilation_database, other.m_dirty_compilation_database);
+    swap(m_rebuild_cancelled, other.m_rebuild_cancelled);
+    swap(m_rebuild_restarts, other.m_rebuild_restarts);
     swap(m_compilation_database, other.m_compilation_database);
+    swap(m_published_serialization, other.m_published_serialization);
+    swap(m_shard_hashes, other.m_shard_hashes);
+    swap(m_merged_database_stale, other.m_merged_database_stale);
+    swap(m_change_journal, other.m_change_journal);
+    swap(m_change_detector, other.m_change_detector);
+    swap(m_flag_model, other.m_flag_model);
+    swap(m_command_expander, other.m_command_expander);
+    swap(m_io, other.m_io);
+    swap(m_budget, other.m_budget);
+    swap(m_memory_degraded, other.m_memory_degraded);
+    swap(m_deferred_regeneration, other.m_deferred_regeneration);
 }
 
-bool workspace::check_for_updates() {
-    fd_set descriptor_set;
-    FD_ZERO(&descriptor_set);
-    FD_SET(m_notify_fd, &descriptor_set);
+bool workspace::check_for_updates(std::optional<std::chrono::milliseconds> timeout) {
+    // Unmatched halves of moves have to be handled once they expire, even if no other events arrive
+    if (!m_pending_moves.empty()) {
+        auto until_expired = std::chrono::ceil<std::chrono::milliseconds>(m_pending_moves.front().expires_at -
+                                                                          std::chrono::steady_clock::now());
+        until_expired = std::max(until_expired, std::chrono::milliseconds(0));
 
-    int ret = pselect(m_notify_fd + 1, &descriptor_set, nullptr, nullptr, nullptr, nullptr);
+        if (!timeout || until_expired < *timeout) {
+            timeout = until_expired;
+        }
+    }
 
-    if (ret == -1) {
-        perror("Error selecting");
-        return false;
+    // A regeneration which was over the budget runs once it fits, even without new events
+    if (m_deferred_regeneration) {
+        auto until_due = std::chrono::ceil<std::chrono::milliseconds>(*m_deferred_regeneration -
+                                                                      std::chrono::steady_clock::now());
+        until_due = std::max(until_due, std::chrono::milliseconds(0));
+
+        if (!timeout || until_due < *timeout) {
+            timeout = until_due;
+        }
     }
 
-    if (FD_ISSET(m_notify_fd, &descriptor_set)) {
-        inotify_handler();
+    // A cancelled rebuild is restarted right away with the newer events
+    const bool received_events = m_rebuild_cancelled || m_event_reader->wait_for_events(timeout);
+    const bool expired_moves =
+        !m_pending_moves.empty() && m_pending_moves.front().expires_at <= std::chrono::steady_clock::now();
+    const bool deferred_due =
+        m_deferred_regeneration && *m_deferred_regeneration <= std::chrono::steady_clock::now();
+
+    if (!received_events && !expired_moves && !deferred_due) {
+        // Nothing else is waiting, so this is when the merged database is brought up to date
+        if (m_config.sharded_output() && m_config.merged_output()) {
+            merged_database();
+        }
+
+        return false;
     }
 
+    inotify_handler();
+    // New headers are published on their own first, the full rebuild can take much longer on large projects
+    publish_priority_headers();
     update_compilation_database();
     return true;
 }
 
 void workspace::default_handler(workspace &workspace_instance, const workspace_event &event) {
-    if (!workspace_instance.is_relevant_file(event.affected_path())) {
+    // Frequent events like opened or accessed are dropped here, before the expensive relevance check
+    constexpr uint32_t handled_events =
+        IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_DELETE_SELF | IN_MODIFY | IN_MOVED_FROM | IN_MOVED_TO;
+    // Only needed to know which headers are in use, these never need the relevance check
+    constexpr uint32_t usage_events = IN_OPEN | IN_ACCESS;
+    const uint32_t event_mask =
+        static_cast<uint32_t>(event.event_mask()) &
+        (workspace_instance.lazy_augmentation() ? handled_events | usage_events : handled_events);
+    const auto affected_path = event.affected_path_view();
+    // The kernel tells if the entry of an event is a directory, only events of the watched entry itself don't have it
+    const bool is_directory = static_cast<uint32_t>(event.event_mask()) & IN_ISDIR;
+    const bool is_self_event = event_mask & IN_DELETE_SELF;
+
+    if (event_mask == 0) {
         return;
     }
 
-    if (auto directory_watch = event.directory_watch();
-        directory_watch.has_value() && event.event_mask() & workspace_events::deleted_self) {
-        auto result = workspace_instance.m_directory_watches.find(*directory_watch);
+    // Response files can be anywhere in the watched directories, so this is checked before the relevance
+    if (!is_directory && (event_mask & (IN_CLOSE_WRITE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)) &&
+        workspace_instance.m_command_expander->invalidate(affected_path)) {
+        workspace_instance.response_file_changed();
+    }
 
-        if (result == workspace_instance.m_directory_watches.cend()) {
-            return;
+    // Editors either write the config in place or move a new file over it
+    if (!is_directory && (event_mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) &&
+        event.affected_id() == workspace_instance.m_config_id && event.affected_id() != invalid_path_id) {
+        workspace_instance.reload_config();
+        return;
+    }
+
+    // Removals only need to know if the path is interned, which is cheaper than matching the patterns
+    std::optional<bool> relevant;
+    const auto is_relevant = [&]() {
+        if (!relevant) {
+            relevant = is_relevant_file(affected_path, workspace_instance.m_config,
+                                        is_self_event ? std::nullopt : std::optional<bool>(!is_directory));
         }
 
-        inotify_rm_watch(workspace_instance.m_notify_fd, result->first);
-        workspace_instance.m_directory_watches.erase(result);
-        std::cout << "Removed watch for " << event.affected_path().c_str() << std::endl;
-    }
+        return *relevant;
+    };
 
     // TODO add whitelist/blacklist to this maybe
-    if (fs::is_directory(event.affected_path())) {
-        if (event.event_mask() & workspace_events::created) {
-            int directory_watch =
-                inotify_add_watch(workspace_instance.m_notify_fd, event.affected_path().c_str(), IN_ALL_EVENTS);
+    // The change detection decides if the new input database actually differs
+    const auto input_database = workspace_instance.m_config.compilation_database_path();
+    const bool is_input_database = !is_directory && input_database && affected_path == input_database->native();
+
+    // Handles every event type in the mask on its own, from the lowest bit to the highest
+    for (uint32_t remaining = event_mask; remaining != 0; remaining &= remaining - 1) {
+        switch (static_cast<workspace_events>(remaining & (~remaining + 1))) {
+            case workspace_events::deleted_self:
+                if (auto directory_watch = event.directory_watch(); directory_watch.has_value()) {
+                    workspace_instance.remove_directory_watch(*directory_watch);
+                }
+                break;
+            case workspace_events::created:
+                if (!is_relevant()) {
+                    break;
+                }
+
+                if (is_directory) {
+                    workspace_instance.scan_directory(affected_path);
+                } else {
+                    std::cout << "Added file " << affected_path << std::endl;
+                    const path_id file_id = workspace_instance.add_relevant_file(affected_path);
+                    workspace_instance.activate_header(file_id);
+                    workspace_instance.prioritize_header(file_id);
+                }
+                break;
+            case workspace_events::moved_to:
+                // Both halves of a directory move were already applied by the workspace
+                if (event.m_is_paired_move || !is_relevant()) {
+                    break;
+                }
+
+                // Directories from outside of the watched ones are scanned, the others were renamed in place
+                if (is_directory) {
+                    workspace_instance.scan_directory(affected_path);
+                } else {
+                    std::cout << "Moved file to " << affected_path << std::endl;
+                    const path_id file_id = workspace_instance.add_relevant_file(affected_path);
+                    workspace_instance.activate_header(file_id);
+                    workspace_instance.prioritize_header(file_id);
+                }
+
+                if (is_input_database) {
+                    workspace_instance.compilation_database_is_dirty();
+                }
+                break;
+            case workspace_events::modified:
+                if (!is_directory && is_relevant()) {
+                    std::cout << "File was modified " << affected_path << std::endl;
+                }
+                break;
+            case workspace_events::moved_from:
+            case workspace_events::deleted: {
+                if (event.m_is_paired_move) {
+                    break;
+                }
 
-            if (directory_watch == -1) {
-                return;
+                // Paths which aren't interned can't be relevant files or watched directories
+                const auto affected_id = event.affected_id() != invalid_path_id
+                                             ? event.affected_id()
+                                             : workspace_instance.m_paths.find(affected_path);
+
+                if (affected_id != invalid_path_id) {
+                    std::cout << "Deleted/Moved file from " << affected_path << std::endl;
+                    workspace_instance.remove_subtree(affected_id);
+                }
+                break;
             }
+            case workspace_events::closed_write:
+                if (!is_relevant()) {
+                    break;
+                }
+
+                if (!is_directory) {
+                    std::cout << "Close write file " << affected_path << std::endl;
+                    workspace_instance.activate_header(event.affected_id());
+                    workspace_instance.prioritize_header(event.affected_id());
+                }
+
+                if (is_input_database) {
+                    workspace_instance.compilation_database_is_dirty();
+                }
+                break;
+            case workspace_events::opened:
+            case workspace_events::accessed:
+                // Relevant files are always interned, so the ID alone decides if this is a header in the project
+                if (!is_directory && workspace_instance.activate_header(event.affected_id())) {
+                    workspace_instance.prioritize_header(event.affected_id());
+                }
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+void workspace::add_directory_watch(std::string_view directory) {
+    const path_id directory_id = m_paths.intern(directory);
+    m_paths.write_path(directory_id, m_path_buffer);
+    int directory_watch = inotify_add_watch(m_notify_fd, m_path_buffer.c_str(), IN_ALL_EVENTS);
+
+    if (directory_watch == -1) {
+        return;
+    }
+
+    set_directory_watch(directory_watch, directory_id);
+    std::cout << "Added directory watch for " << m_path_buffer << std::endl;
+}
+
+void workspace::remove_directory_watch(int directory_watch) {
+    const path_id directory_id = watched_path(directory_watch);
+
+    if (directory_id == invalid_path_id) {
+        return;
+    }
+
+    inotify_rm_watch(m_notify_fd, directory_watch);
+    set_directory_watch(directory_watch, invalid_path_id);
+    std::cout << "Removed watch for " << m_paths.path(directory_id).c_str() << std::endl;
+}
+
+void workspace::set_directory_watch(int directory_watch, path_id directory_id) {
+    if (directory_watch < 0) {
+        return;
+    }
+
+    // Both directions are plain vectors, watch descriptors and path IDs are small and dense
+    if (static_cast<size_t>(directory_watch) >= m_directory_watches.size()) {
+        m_directory_watches.resize(std::max<size_t>(directory_watch + 1, m_directory_watches.size() * 2),
+                                   invalid_path_id);
+    }
+
+    if (auto previous_id = m_directory_watches[directory_watch]; previous_id != invalid_path_id) {
+        m_path_watches[previous_id] = -1;
+    }
+
+    m_directory_watches[directory_watch] = directory_id;
+
+    if (directory_id == invalid_path_id) {
+        return;
+    }
+
+    if (directory_id >= m_path_watches.size()) {
+        m_path_watches.resize(std::max<size_t>(directory_id + 1, m_path_watches.size() * 2), -1);
+    }
+
+    m_path_watches[directory_id] = directory_watch;
+}
+
+path_id workspace::watched_path(int directory_watch) const {
+    if (directory_watch < 0 || static_cast<size_t>(directory_watch) >= m_directory_watches.size()) {
+        return invalid_path_id;
+    }
+
+    return m_directory_watches[directory_watch];
+}
+
+path_id workspace::add_relevant_file(std::string_view file) {
+    const path_id file_id = m_paths.intern(file);
 
-            workspace_instance.m_directory_watches.emplace(directory_watch, event.affected_path());
-            std::cout << "Added directory watch for " << event.affected_path().c_str() << std::endl;
+    if (m_relevant_files.insert(file_id)) {
+        m_change_detector.relevant_file_added(file);
+        compilation_database_is_dirty();
+    }
+
+    return file_id;
+}
+
+bool workspace::activate_header(path_id header) {
+    if (!lazy_augmentation() || !is_relevant_header(header)) {
+        return false;
+    }
+
+    // Using a header which already has an entry only changes the order, which doesn't need a rebuild
+    const bool inserted = m_active_headers.touch(header);
+
+    if (inserted) {
+        m_change_detector.working_set_added(header);
+        compilation_database_is_dirty();
+    }
+
+    for (auto evicted = m_active_headers.evict_excess(); evicted != invalid_path_id;
+         evicted = m_active_headers.evict_excess()) {
+        m_change_detector.working_set_removed(evicted);
+    }
+
+    return inserted;
+}
+
+bool workspace::lazy_augmentation() const { return m_config.lazy_augmentation() || m_memory_degraded; }
+
+void workspace::seed_active_headers() {
+    m_published_headers.for_each([this](path_id header) {
+        if (m_active_headers.size() < m_active_headers.capacity() && is_relevant_header(header) &&
+            m_active_headers.touch(header)) {
+            m_change_detector.working_set_added(header);
         }
+    });
+}
+
+bool workspace::is_relevant_header(path_id file) const {
+    return file != invalid_path_id && m_relevant_files.contains(file) &&
+           classify_file(m_paths.name(file)) == file_kind::header;
+}
+
+void workspace::prioritize_header(path_id header) {
+    if (!is_relevant_header(header) || m_published_headers.contains(header) ||
+        (lazy_augmentation() && !m_active_headers.contains(header))) {
+        return;
+    }
+
+    if (std::find(m_priority_headers.cbegin(), m_priority_headers.cend(), header) == m_priority_headers.cend()) {
+        m_priority_headers.push_back(header);
+    }
+}
+
+void workspace::publish_priority_headers() {
+    if (m_priority_headers.empty()) {
+        return;
+    }
+
+    // Without a published database the full rebuild has to run anyway
+    if (!m_compilation_database || !m_dirty_compilation_database) {
+        m_priority_headers.clear();
+        return;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<fs::path> headers;
+    std::vector<path_id> header_ids;
+    headers.reserve(m_priority_headers.size());
+
+    // Some of them might have been removed again in the same batch of events
+    for (auto header : m_priority_headers) {
+        if (is_relevant_header(header)) {
+            headers.emplace_back(m_paths.path(header));
+            header_ids.push_back(header);
+        }
+    }
+
+    m_priority_headers.clear();
+
+    // Only the original entries are donors, so the appended entries are the same as the ones of the full rebuild
+    const size_t appended_from = m_compilation_database->database().size();
+
+    if (!m_compilation_database->add_missing_files(
+            headers, m_config,
+            augmentation_options{}
+                .num_threads(m_budget.worker_threads())
+                .flag_model(&m_flag_model)
+                .expander(m_command_expander.get()))) {
+        return;
+    }
+
+    // Headers which weren't published can be prioritized again by their next event
+    if (!write_compilation_database(appended_from)) {
+        return;
+    }
+
+    for (auto header : header_ids) {
+        m_published_headers.insert(header);
+    }
+
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    logger::instance()->log_info(
+        "Published " + std::to_string(headers.size()) + " new headers ahead of the rebuild in " +
+        std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count()) + " ms");
+}
+
+void workspace::remove_subtree(path_id root) {
+    m_paths.for_each_descendant(root, [this](path_id current_id) {
+        if (m_relevant_files.erase(current_id)) {
+            m_paths.write_path(current_id, m_path_buffer);
+            m_change_detector.relevant_file_removed(m_path_buffer);
+            compilation_database_is_dirty();
+        }
+
+        if (m_active_headers.erase(current_id)) {
+            m_change_detector.working_set_removed(current_id);
+        }
+
+        // The kernel keeps watching directories which were moved out of the project
+        if (current_id < m_path_watches.size() && m_path_watches[current_id] != -1) {
+            remove_directory_watch(m_path_watches[current_id]);
+        }
+    });
+}
+
+void workspace::move_directory(path_id directory, path_id new_parent, std::string_view new_name) {
+    // The fingerprint and the relevance of the files below depend on their paths
+    m_paths.for_each_descendant(directory, [this](path_id current_id) {
+        if (m_relevant_files.contains(current_id)) {
+            m_paths.write_path(current_id, m_path_buffer);
+            m_change_detector.relevant_file_removed(m_path_buffer);
+        }
+    });
+
+    // Replaces whatever was at the destination before
+    if (auto existing_id = m_paths.find(new_parent, new_name);
+        existing_id != invalid_path_id && existing_id != directory) {
+        remove_subtree(existing_id);
+    }
+
+    m_paths.rename(directory, new_parent, new_name);
+
+    m_paths.for_each_descendant(directory, [this](path_id current_id) {
+        if (!m_relevant_files.contains(current_id)) {
+            return;
+        }
+
+        m_paths.write_path(current_id, m_path_buffer);
+
+        if (is_relevant_file(std::string_view(m_path_buffer), m_config)) {
+            m_change_detector.relevant_file_added(m_path_buffer);
+        } else {
+            m_relevant_files.erase(current_id);
+        }
+    });
+
+    m_paths.write_path(directory, m_path_buffer);
+    std::cout << "Moved directory to " << m_path_buffer << std::endl;
+    compilation_database_is_dirty();
+}
+
+void workspace::flush_expired_moves() {
+    const auto now = std::chrono::steady_clock::now();
+    // Sorted by expiry, since every move gets the same timeout
+    auto expired_end = std::find_if(m_pending_moves.begin(), m_pending_moves.end(),
+                                    [now](const auto &current_move) { return current_move.expires_at > now; });
+
+    // Moves out of the watched directories only have the first half, so they are deletions
+    for (auto it = m_pending_moves.begin(); it != expired_end; ++it) {
+        send_event(it->mask, it->affected_id, it->path, it->directory_watch);
+    }
+
+    m_pending_moves.erase(m_pending_moves.begin(), expired_end);
+}
+
+void workspace::scan_directory(std::string_view directory) {
+    const fs::path directory_path(directory);
+
+    add_directory_watch(directory_path.native());
+    add_relevant_file(directory_path.native());
+    scan_below(directory_path);
+}
+
+void workspace::scan_below(const fs::path &directory_path) {
+    // Everything below was created before the watch existed, so there won't be any events for it
+    m_io.walk(directory_path, [this](const std::string &path, bool is_directory, bool is_regular_file) {
+        if (!is_relevant_file(path, m_config, !is_directory && is_regular_file)) {
+            return;
+        }
+
+        if (is_directory) {
+            add_directory_watch(path);
+        }
+
+        add_relevant_file(path);
+    });
+}
+
+void workspace::scan_project_root() {
+    const auto root = project_root().native();
+
+    if (is_relevant_file(std::string_view(root), m_config, false)) {
+        scan_directory(root);
     } else {
-        // TODO only watch for source or header files
-        if (event.event_mask() & workspace_events::created) {
-            std::cout << "Added file " << event.affected_path().c_str() << std::endl;
-            auto updated = workspace_instance.m_relevant_files.emplace(event.affected_path());
+        scan_below(root);
+    }
+}
 
-            if (updated.second) {
-                workspace_instance.compilation_database_is_dirty();
-            }
+void workspace::remove_irrelevant_watches() {
+    const auto input_database = m_config.compilation_database_path();
+    const path_id input_database_id = input_database ? m_paths.find(input_database->native()) : invalid_path_id;
+    const path_id config_directory_id = m_config_id != invalid_path_id ? m_paths.parent(m_config_id) : invalid_path_id;
+
+    for (size_t directory_watch = 0; directory_watch < m_directory_watches.size(); ++directory_watch) {
+        const path_id watched_id = m_directory_watches[directory_watch];
+
+        if (watched_id != invalid_path_id && watched_id != input_database_id && watched_id != config_directory_id &&
+            !m_relevant_files.contains(watched_id)) {
+            remove_directory_watch(static_cast<int>(directory_watch));
         }
+    }
+}
+
+void workspace::scan_prefix(const fs::path &directory, std::string_view name_prefix) {
+    std::error_code ec;
 
-        if (event.event_mask() & workspace_events::moved_to) {
-            std::cout << "Moved file to " << event.affected_path().c_str() << std::endl;
-            auto updated = workspace_instance.m_relevant_files.emplace(event.affected_path());
+    for (auto it = fs::directory_iterator(directory, ec); !ec && it != fs::directory_iterator(); it.increment(ec)) {
+        const auto &path = it->path().native();
 
-            if (updated.second) {
-                workspace_instance.compilation_database_is_dirty();
+        if (filename_of(path).substr(0, name_prefix.size()) != name_prefix) {
+            continue;
+        }
+
+        if (!it->is_directory()) {
+            if (is_relevant_file(path, m_config, it->is_regular_file())) {
+                add_relevant_file(path);
             }
+        } else if (is_relevant_file(path, m_config, false)) {
+            scan_directory(path);
+        } else {
+            scan_below(it->path());
         }
+    }
+}
+
+void workspace::watch_config_file() {
+    if (!m_config_path) {
+        return;
+    }
+
+    // The file itself would lose its watch when an editor replaces it
+    m_config_id = m_paths.intern(m_config_path->native());
+    const path_id directory_id = m_paths.parent(m_config_id);
+    m_paths.write_path(directory_id, m_path_buffer);
+    int directory_watch =
+        inotify_add_watch(m_notify_fd, m_path_buffer.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_MASK_ADD);
+
+    if (directory_watch == -1) {
+        logger::instance()->log_warning("Couldn't watch the config " + m_config_path->native() +
+                                        ", changes to it need a restart");
+        return;
+    }
+
+    set_directory_watch(directory_watch, directory_id);
+}
+
+void workspace::reload_config() {
+    auto logger_instance = logger::instance();
+    auto loaded = config::load_config(*m_config_path);
+
+    if (!loaded) {
+        logger_instance->log_error("Couldn't read the changed config " + m_config_path->native() +
+                                   ", keeping the previous one");
+        return;
+    }
+
+    loaded->project_root(project_root());
+
+    // The database found in the project stays the input, unless the config names another one
+    if (!loaded->compilation_database_path() && m_config.compilation_database_path()) {
+        loaded->compilation_database_path(*m_config.compilation_database_path());
+    }
+
+    const bool was_lazy = lazy_augmentation();
+    const config previous = std::exchange(m_config, *loaded);
+    m_budget.limits(resource_limits::from_config(m_config));
+
+    // A new memory budget starts over, enforce_budget degrades again if it isn't enough
+    if (previous.max_memory_mb() != m_config.max_memory_mb()) {
+        m_memory_degraded = false;
+    }
+    logger_instance->log_info("Reloaded the config " + m_config_path->native());
+
+    // Entries of headers are only generated again if the way their flags are derived changed
+    const bool flag_rules_changed = previous.get_flags_from() != m_config.get_flags_from() ||
+                                    previous.flag_inheritance() != m_config.flag_inheritance() ||
+                                    previous.canonicalize_flags() != m_config.canonicalize_flags();
+    const bool output_changed = previous.compact_output() != m_config.compact_output() ||
+                                previous.sharded_output() != m_config.sharded_output() ||
+                                was_lazy != lazy_augmentation();
+
+    if (flag_rules_changed) {
+        m_flag_model = directory_flag_model(m_config.flag_aggregation_mode());
+    }
 
-        if (event.event_mask() & workspace_events::modified) {
-            std::cout << "File was modified " << event.affected_path().c_str() << std::endl;
+    if (previous.io_uring_backend() != m_config.io_uring_backend()) {
+        m_io = batch_io(m_config.io_uring_backend());
+    }
+
+    if (previous.max_lazy_entries() != m_config.max_lazy_entries()) {
+        m_active_headers.capacity(m_config.max_lazy_entries());
+
+        for (auto evicted = m_active_headers.evict_excess(); evicted != invalid_path_id;
+             evicted = m_active_headers.evict_excess()) {
+            m_change_detector.working_set_removed(evicted);
+            compilation_database_is_dirty();
         }
+    }
+
+    if (!was_lazy && lazy_augmentation()) {
+        seed_active_headers();
+    }
+
+    if (flag_rules_changed || output_changed) {
+        m_change_detector.input_changed();
+        compilation_database_is_dirty();
+    }
 
-        if (event.event_mask() & workspace_events::moved_from || event.event_mask() & workspace_events::deleted) {
-            std::cout << "Deleted/Moved file from " << event.affected_path().c_str() << std::endl;
+    update_relevance(previous);
+}
+
+void workspace::update_relevance(const config &previous) {
+    const auto previous_patterns = previous.resolved_whitelist_patterns();
+    const auto patterns = m_config.resolved_whitelist_patterns();
+    const auto missing_from = [](const std::vector<std::string> &from) {
+        return [&from](const std::string &pattern) {
+            return std::find(from.cbegin(), from.cend(), pattern) == from.cend();
+        };
+    };
+    const bool removed_patterns =
+        std::any_of(previous_patterns.cbegin(), previous_patterns.cend(), missing_from(patterns));
+
+    // Everything which matched a removed pattern is interned already, so this doesn't need the filesystem
+    if (removed_patterns) {
+        std::vector<path_id> dropped;
+
+        // Relevant files without an extension are always directories
+        m_relevant_files.for_each([&](path_id file) {
+            m_paths.write_path(file, m_path_buffer);
+
+            if (!is_relevant_file(std::string_view(m_path_buffer), m_config, false)) {
+                dropped.push_back(file);
+            }
+        });
 
-            auto to_remove = std::find(workspace_instance.m_relevant_files.cbegin(),
-                                       workspace_instance.m_relevant_files.cend(), event.affected_path());
+        for (auto file : dropped) {
+            m_relevant_files.erase(file);
+            m_paths.write_path(file, m_path_buffer);
+            m_change_detector.relevant_file_removed(m_path_buffer);
 
-            if (to_remove != workspace_instance.m_relevant_files.cend()) {
-                workspace_instance.m_relevant_files.erase(to_remove);
-                workspace_instance.compilation_database_is_dirty();
+            if (m_active_headers.erase(file)) {
+                m_change_detector.working_set_removed(file);
             }
         }
 
-        if (event.event_mask() & workspace_events::closed_write) {
-            std::cout << "Close write file " << event.affected_path().c_str() << std::endl;
-            // Add flags back to compile_commands.json
+        remove_irrelevant_watches();
+
+        if (!dropped.empty()) {
+            logger::instance()->log_info(std::to_string(dropped.size()) + " files aren't relevant anymore");
+            compilation_database_is_dirty();
+        }
+    }
+
+    // Newly relevant paths have to match one of the added patterns, so only the directories those can match are scanned
+    std::vector<std::pair<fs::path, std::string>> scanned_locations;
+    const auto root = project_root().native();
+    bool scan_project = false;
+
+    for (const auto &current_pattern : patterns) {
+        if (!missing_from(previous_patterns)(current_pattern)) {
+            continue;
+        }
+
+        const auto location = literal_location_of(current_pattern);
+
+        if (location && is_within(location->first, root)) {
+            scanned_locations.emplace_back(location->first, location->second);
+        } else if (!location || is_within(root, location->first)) {
+            scan_project = true;
         }
     }
 
-    // std::cout << "Relevant files : " << '\n';
-    // for (const auto &current_element : m_relevant_files) {
-    //     std::cout << current_element << '\n';
-    // }
-    // std::cout << std::endl;
+    if (scan_project) {
+        logger::instance()->log_info("The added patterns can match anywhere, rescanning the project");
+        scan_project_root();
+        return;
+    }
+
+    for (const auto &[directory, name_prefix] : scanned_locations) {
+        scan_prefix(directory, name_prefix);
+    }
+}
+
+template<typename Func>
+void workspace::for_each_augmented_header(Func func) const {
+    // The working set only holds relevant headers, so the cost of a rebuild doesn't depend on the size of the project
+    if (lazy_augmentation()) {
+        m_active_headers.for_each(func);
+        return;
+    }
+
+    m_relevant_files.for_each([&](path_id file) {
+        if (classify_file(m_paths.name(file)) == file_kind::header) {
+            func(file);
+        }
+    });
+}
+
+std::vector<fs::path> workspace::relevant_headers() const {
+    std::vector<fs::path> headers;
+
+    for_each_augmented_header([&](path_id header) { headers.emplace_back(m_paths.path(header)); });
+
+    std::sort(headers.begin(), headers.end(),
+              [](const auto &lhs, const auto &rhs) { return lhs.native() < rhs.native(); });
+
+    return headers;
 }
 
 void workspace::inotify_handler() {
-    constexpr size_t buffer_size = 4096;
-    std::aligned_storage_t<buffer_size, sizeof(inotify_event)> aligned_buffer;
+    if (m_event_reader->overflowed()) {
+        logger::instance()->log_warning("Lost inotify events, rescanning the project and its watches");
+        m_pending_moves.clear();
+        m_relevant_files.clear();
+        m_change_detector.relevant_files_cleared();
+        // Directories created meanwhile get their watches here, the ones of removed directories are dropped after
+        scan_project_root();
+        remove_irrelevant_watches();
+        compilation_database_is_dirty();
+    }
+
+    while (auto event = m_event_reader->next_event()) {
+        const path_id directory_id = watched_path(event->directory_watch);
 
-    char *as_char_buffer = reinterpret_cast<char *>(&aligned_buffer);
-    const inotify_event *event = nullptr;
-    ssize_t len_read = 0;
+        if (directory_id == invalid_path_id) {
+            // TODO print warning that no matching inotify watch was found
+            continue;
+        }
 
-    while (1) {
-        len_read = read(m_notify_fd, as_char_buffer, buffer_size);
+        // Only relevant files are interned, for everything else the path is just assembled in the reused buffer
+        const path_id affected_id = m_paths.find(directory_id, event->name);
+        m_paths.write_path(affected_id != invalid_path_id ? affected_id : directory_id, m_event_path);
 
-        if (len_read == -1 && errno != EAGAIN) {
-            return;
+        if (affected_id == invalid_path_id) {
+            if (!m_event_path.empty() && m_event_path.back() != '/') {
+                m_event_path.push_back('/');
+            }
+
+            m_event_path.append(event->name);
         }
 
-        if (len_read <= 0) {
-            return;
+        if (m_change_detector.is_self_inflicted(m_event_path)) {
+            continue;
         }
 
-        for (auto it = as_char_buffer; it < as_char_buffer + len_read; it += sizeof(inotify_event) + event->len) {
-            event = reinterpret_cast<const inotify_event *>(it);
-            auto result = m_directory_watches.find(event->wd);
+        // A directory move is applied in place once both halves arrived, files are just removed and added again. The
+        // halves can end up in different batches, so unmatched ones wait until move_pairing_timeout expired.
+        const bool is_directory = event->mask & IN_ISDIR;
 
-            if (result == m_directory_watches.cend()) {
-                // TODO print warning that no matching inotify watch was found
-                continue;
-            }
+        if (is_directory && (event->mask & IN_MOVED_FROM) && affected_id != invalid_path_id) {
+            m_pending_moves.push_back({event->cookie, event->mask, event->directory_watch, affected_id, m_event_path,
+                                       std::chrono::steady_clock::now() + move_pairing_timeout});
+            continue;
+        }
+
+        if (is_directory && (event->mask & IN_MOVED_TO)) {
+            auto pending_move = std::find_if(m_pending_moves.begin(), m_pending_moves.end(),
+                                             [&event](const auto &move) { return move.cookie == event->cookie; });
 
-            auto affected_path = result->second / fs::path(event->name);
-            bool is_directory = fs::is_directory(affected_path);
+            if (pending_move != m_pending_moves.end()) {
+                const auto moved_from = std::move(*pending_move);
+                m_pending_moves.erase(pending_move);
+                move_directory(moved_from.affected_id, directory_id, event->name);
 
-            send_event(event->mask, affected_path, event->wd);
+                // The handlers still see both halves, but marked as already applied
+                send_event(moved_from.mask, moved_from.affected_id, moved_from.path, moved_from.directory_watch, true);
+                m_paths.write_path(moved_from.affected_id, m_event_path);
+                send_event(event->mask, moved_from.affected_id, m_event_path, event->directory_watch, true);
+                continue;
+            }
         }
+
+        send_event(event->mask, affected_id, m_event_path, event->directory_watch);
     }
+
+    flush_expired_moves();
 }
 
-void workspace::send_event(uint32_t mask, const fs::path &affected_path, int directory_watch) {
-    workspace_event event(workspace_events(mask), affected_path);
+void workspace::send_event(uint32_t mask, path_id affected_id, std::string_view affected_path, int directory_watch,
+                           bool is_paired_move) {
+    workspace_event event(workspace_events(mask), affected_id, affected_path);
     event.directory_watch(directory_watch);
+    event.m_is_paired_move = is_paired_move;
 
     for (const auto &current_function : m_event_handlers) {
         if (current_function) {
@@ -210,22 +994,33 @@ void workspace::send_event(uint32_t mask, const fs::path &affected_path, int dir
 }
 
 bool workspace::is_relevant_file(const fs::path &path, const config &conf) {
+    return is_relevant_file(std::string_view(path.native()), conf);
+}
+
+bool workspace::is_relevant_file(std::string_view path_as_string, const config &conf,
+                                 std::optional<bool> is_regular_file) {
     const std::vector<std::regex> &prepared_blacklist_patterns = conf.prepared_blacklist_patterns();
     const std::vector<std::regex> &prepared_whitelist_patterns = conf.prepared_whitelist_patterns();
-    const auto path_as_string = path.string();
 
     const auto match_func = [&path_as_string](auto &current_pattern) {
         bool result = std::regex_search(path_as_string.cbegin(), path_as_string.cend(), current_pattern);
         return result;
     };
 
-    if (fs::is_regular_file(path) && !path.has_extension()) {
-        return false;
-    }
+    // Sources and headers are always regular files, so only the other files need to be checked on disk
+    if (classify_file(path_as_string) == file_kind::other) {
+        auto filename = filename_of(path_as_string);
+        auto dot = filename.rfind('.');
+        const bool has_extension = dot != std::string_view::npos && dot != 0 && filename != "..";
 
-    if (fs::is_regular_file(path) && path.has_extension() && path.extension().string().back() == '~') {
-        std::cout << path << std::endl;
-        return false;
+        if ((!has_extension || filename.back() == '~') &&
+            (is_regular_file ? *is_regular_file : fs::is_regular_file(fs::path(path_as_string)))) {
+            if (has_extension) {
+                std::cout << path_as_string << std::endl;
+            }
+
+            return false;
+        }
     }
 
     // TODO: add back blacklist functionality
@@ -236,16 +1031,202 @@ bool workspace::is_relevant_file(const fs::path &path, const config &conf) {
     return relevant;
 }
 
-bool workspace::is_relevant_file(const fs::path &path) const { return is_relevant_file(path, m_config); }
+bool workspace::request_header(const fs::path &header) {
+    const path_id header_id = m_paths.find(header.native());
+
+    if (header_id == invalid_path_id || !m_relevant_files.contains(header_id) ||
+        classify_file(m_paths.name(header_id)) != file_kind::header) {
+        return false;
+    }
+
+    activate_header(header_id);
+    update_compilation_database();
+    return true;
+}
+
+fs::path workspace::shard_path(std::string_view shard) const {
+    return project_root() / shard / compilation_database::database_name;
+}
+
+bool workspace::replace_file(const fs::path &path, const std::string &content) {
+    // Renamed into place, so readers never see a partially written file
+    const auto tmp_file = path.parent_path() / temporary_database_path().filename();
+    m_change_detector.ignore_path(path);
+    m_change_detector.ignore_path(tmp_file);
+
+    if (!compilation_database::write_serialized_to(tmp_file, content)) {
+        return false;
+    }
+
+    std::error_code ec;
+    fs::rename(tmp_file, path, ec);
+    return !ec;
+}
+
+bool workspace::write_shards(std::optional<size_t> appended_from) {
+    const auto root = project_root();
+    const auto &database = m_compilation_database->database();
+    const auto input_database = m_config.compilation_database_path();
+
+    // The shard which would replace the input database goes into the one of the project root instead
+    const auto shard_of = [&](std::string_view file) {
+        auto shard = top_level_directory(file, root.native());
+        return !shard.empty() && input_database && shard_path(shard) == *input_database ? std::string_view{} : shard;
+    };
+
+    // Shards of an earlier run are only known from its manifest, their content is compared when they are written
+    if (m_shard_hashes.empty()) {
+        for (const auto &previous_shard : read_shard_manifest(root)) {
+            const auto shard = top_level_directory(previous_shard, root.native());
+
+            if (shard_path(shard) == previous_shard) {
+                m_shard_hashes.try_emplace(std::string(shard), 0);
+            }
+        }
+    }
+
+    std::map<std::string_view, std::vector<size_t>> shards;
+    std::set<std::string_view> affected_shards;
+
+    for (size_t i = 0; i < database.size(); ++i) {
+        auto shard = shard_of(string_member(database[i], "file"));
+        shards[shard].push_back(i);
+
+        if (appended_from && i >= *appended_from) {
+            affected_shards.insert(shard);
+        }
+    }
+
+    size_t written_shards = 0;
+    size_t written_bytes = 0;
+    size_t failed_shards = 0;
+    bool shards_changed = false;
+
+    for (const auto &[shard, indices] : shards) {
+        if (appended_from && affected_shards.count(shard) == 0) {
+            continue;
+        }
+
+        const auto serialized = m_compilation_database->serialize_entries(indices);
+        const uint64_t hash = hash_bytes(serialized);
+        const auto path = shard_path(shard);
+        auto [written_hash, inserted] = m_shard_hashes.try_emplace(std::string(shard), 0);
+
+        shards_changed = shards_changed || inserted;
+
+        // Shards from an earlier run are only replaced if they differ
+        if (written_hash->second == 0) {
+            if (auto on_disk = change_detector::fingerprint(path); on_disk && on_disk->content_hash == hash) {
+                written_hash->second = hash;
+                m_change_detector.ignore_path(path);
+            }
+        }
+
+        if (written_hash->second == hash) {
+            continue;
+        }
+
+        if (!replace_file(path, serialized)) {
+            logger::instance()->log_error("Couldn't write the shard " + path.string());
+            ++failed_shards;
+            continue;
+        }
+
+        written_hash->second = hash;
+        written_bytes += serialized.size();
+        ++written_shards;
+    }
+
+    // Shards without entries are only removed after a full rebuild, appending can't empty them
+    for (auto it = m_shard_hashes.begin(); !appended_from && it != m_shard_hashes.end();) {
+        if (shards.count(it->first) != 0) {
+            ++it;
+            continue;
+        }
+
+        std::error_code ec;
+        fs::remove(shard_path(it->first), ec);
+        it = m_shard_hashes.erase(it);
+        shards_changed = true;
+    }
+
+    if (shards_changed) {
+        write_shard_manifest();
+    }
+
+    m_merged_database_stale = m_merged_database_stale || written_shards > 0;
+    logger::instance()->log_info("Wrote " + std::to_string(written_shards) + " of " + std::to_string(shards.size()) +
+                                 " shards with " + std::to_string(written_bytes) + " bytes");
+
+    return failed_shards == 0;
+}
+
+void workspace::write_shard_manifest() {
+    const auto directory = project_root() / compilation_database::flag_set_directory_name;
+    std::string manifest;
+
+    for (const auto &[shard, hash] : m_shard_hashes) {
+        manifest.append(shard_path(shard).native()).push_back('\n');
+    }
+
+    std::error_code ec;
+    fs::create_directories(directory, ec);
+
+    if (ec || !replace_file(directory / compilation_database::shard_manifest_name, manifest)) {
+        logger::instance()->log_error("Couldn't write the list of shards");
+    }
+}
+
+std::set<fs::path> workspace::generated_databases(const fs::path &project_path) {
+    const auto directory = project_path / compilation_database::flag_set_directory_name;
+    std::set<fs::path> result{directory / compilation_database::database_name};
+
+    for (auto &shard : read_shard_manifest(project_path)) {
+        result.emplace(std::move(shard));
+    }
+
+    return result;
+}
+
+std::optional<fs::path> workspace::merged_database() {
+    if (!m_compilation_database) {
+        return std::nullopt;
+    }
+
+    if (!m_config.sharded_output()) {
+        return project_root() / compilation_database::database_name;
+    }
+
+    const auto directory = project_root() / compilation_database::flag_set_directory_name;
+    const auto merged = directory / compilation_database::database_name;
+
+    if (!m_merged_database_stale) {
+        return merged;
+    }
+
+    std::error_code ec;
+    fs::create_directories(directory, ec);
+
+    if (ec || !replace_file(merged, m_compilation_database->serialize())) {
+        logger::instance()->log_error("Couldn't write the merged compilation database");
+        return std::nullopt;
+    }
+
+    m_merged_database_stale = false;
+    return merged;
+}
 
 const fs::path workspace::project_root() const { return *m_config.project_root(); }
 
+fs::path workspace::temporary_database_path() const { return project_root() / "comp_db.json"; }
+
 void workspace::populate_relevant_files() {
-    for (auto &current_entry : fs::recursive_directory_iterator(*m_config.project_root())) {
-        if (is_relevant_file(current_entry)) {
-            m_relevant_files.emplace(current_entry.path());
+    // The type comes from the directory listing, so this doesn't need another stat
+    m_io.walk(*m_config.project_root(), [this](const std::string &path, bool, bool is_regular_file) {
+        if (is_relevant_file(path, m_config, is_regular_file) && m_relevant_files.insert(m_paths.intern(path))) {
+            m_change_detector.relevant_file_added(path);
         }
-    }
+    });
 }
 
 void workspace::compilation_database_is_dirty() { m_dirty_compilation_database = true; }
@@ -262,32 +1243,211 @@ void workspace::update_compilation_database() {
         return;
     }
 
-    m_compilation_database = compilation_database::read_from(*m_config.compilation_database_path());
+    if (m_change_detector.is_up_to_date(*m_config.compilation_database_path())) {
+        logger_instance->log_info("Nothing changed since the last rebuild of the compilation database, skipping it");
+        m_dirty_compilation_database = false;
+        return;
+    }
 
-    if (!m_compilation_database) {
+    // Changes keep accumulating meanwhile, so a deferred regeneration covers all of them at once
+    if (m_deferred_regeneration && std::chrono::steady_clock::now() < *m_deferred_regeneration) {
+        return;
+    }
+
+    if (auto delay = m_budget.regeneration_delay(); delay.count() > 0) {
+        if (!m_deferred_regeneration) {
+            logger_instance->log_info("Over the budget of " +
+                                      std::to_string(m_budget.limits().max_regenerations_per_minute) +
+                                      " regenerations per minute, waiting " + std::to_string(delay.count()) + " ms");
+        }
+
+        m_deferred_regeneration = std::chrono::steady_clock::now() + delay;
+        return;
+    }
+
+    m_deferred_regeneration.reset();
+
+    // Changes which arrive while rebuilding make the result stale, unless it was restarted too often already
+    const uint64_t change_generation = m_event_reader ? m_event_reader->change_generation() : 0;
+    auto is_stale = [this, change_generation]() {
+        return m_event_reader && m_rebuild_restarts < max_rebuild_restarts &&
+               m_event_reader->change_generation() != change_generation;
+    };
+    m_rebuild_cancelled = false;
+
+    // The published database stays untouched until the rebuild succeeded, new headers are still appended to it
+    auto rebuilt_database = compilation_database::read_from(*m_config.compilation_database_path());
+
+    if (!rebuilt_database) {
         logger_instance->log_error("Couldn't read database");
         return;
     }
 
-    bool added_files = m_compilation_database->add_missing_files(m_relevant_files, m_config);
+    // Response files which weren't changed through the watches are checked once per rebuild, all in parallel
+    m_command_expander->next_generation();
+    m_command_expander->preload(rebuilt_database->database(), m_budget.worker_threads(), &m_io);
+
+    // Only the entries which changed since the last rebuild are updated
+    m_flag_model.update_from(rebuilt_database->database(), m_command_expander.get());
+
+    bool added_files = rebuilt_database->add_missing_files(relevant_headers(), m_config,
+                                                           augmentation_options{}
+                                                               .num_threads(m_budget.worker_threads())
+                                                               .cancellation_check(is_stale)
+                                                               .flag_model(&m_flag_model)
+                                                               .expander(m_command_expander.get()));
+
+    if (const auto statistics = m_command_expander->statistics(); statistics.hits + statistics.misses > 0) {
+        logger_instance->log_info("Response file cache: " + std::to_string(statistics.hits) + " hits, " +
+                                  std::to_string(statistics.misses) + " misses, " +
+                                  std::to_string(static_cast<int>(statistics.hit_rate() * 100)) + "% hit rate");
+    }
+
+    if (is_stale()) {
+        logger_instance->log_info("Newer changes arrived, restarting the rebuild of the compilation database");
+        m_rebuild_cancelled = true;
+        ++m_rebuild_restarts;
+        return;
+    }
+
+    m_rebuild_restarts = 0;
 
     if (!added_files) {
         logger_instance->log_error("Compilation database is already up to date");
         return;
     }
 
-    auto tmp_file = project_root() / "comp_db.json";
-    m_compilation_database->write_to(tmp_file);
-    std::error_code ec;
-    fs::rename(tmp_file, project_root() / compilation_database::database_name, ec);
+    m_compilation_database = std::move(rebuilt_database);
+
+    // Stays dirty instead of taking the database as up to date. Reading the input database causes events itself, so
+    // without the delay a write which keeps failing would be retried right away, over and over.
+    if (!write_compilation_database()) {
+        logger_instance->log_info("Trying to write the compilation database again in " +
+                                  std::to_string(write_retry_delay.count()) + " ms");
+        m_deferred_regeneration = std::chrono::steady_clock::now() + write_retry_delay;
+        return;
+    }
+
+    // Only what was written counts as published, so priority headers aren't skipped after a failed write
+    m_published_headers.clear();
+    for_each_augmented_header([this](path_id header) { m_published_headers.insert(header); });
+    m_change_detector.generated();
     m_dirty_compilation_database = false;
+    m_budget.regenerated();
+    enforce_budget();
 }
 
-std::optional<workspace> workspace::discover_project(const fs::path &project_path, const std::optional<config> &conf) {
-    if (!fs::exists(project_path) || !fs::is_directory(project_path)) {
-        return std::nullopt;
+void workspace::enforce_budget() {
+    auto logger_instance = logger::instance();
+
+    if (m_budget.memory_exceeded()) {
+        // Everything which can be recomputed goes first, malloc keeps freed memory around otherwise
+        m_command_expander->clear();
+        m_published_serialization = {};
+        malloc_trim(0);
+
+        // The entries of headers which aren't in use are the bulk of what is left. Kept apart from the config, so a
+        // reload doesn't switch back and go over the budget again.
+        if (m_budget.memory_exceeded() && !lazy_augmentation()) {
+            logger_instance->log_warning("Over the memory budget after dropping the caches, switching to the lazy "
+                                         "augmentation");
+            m_memory_degraded = true;
+            seed_active_headers();
+            m_change_detector.input_changed();
+            compilation_database_is_dirty();
+        }
+    }
+
+    logger_instance->log_info(m_budget.report());
+}
+
+void workspace::response_file_changed() {
+    m_flag_model = directory_flag_model(m_config.flag_aggregation_mode());
+    m_change_detector.input_changed();
+    compilation_database_is_dirty();
+}
+
+bool workspace::write_compilation_database(std::optional<size_t> appended_from) {
+    auto logger_instance = logger::instance();
+
+    if (m_config.compact_output() &&
+        !m_compilation_database->share_flag_sets(project_root() / compilation_database::flag_set_directory_name)) {
+        logger_instance->log_error("Couldn't write the shared flag sets");
+    }
+
+    if (m_config.sharded_output()) {
+        if (!write_shards(appended_from)) {
+            return false;
+        }
+
+        record_changes(appended_from);
+        return true;
+    }
+
+    // Serializing a large database takes far longer than copying it, so appended entries are spliced into the last one
+    if (appended_from && !m_published_serialization.empty()) {
+        m_compilation_database->serialize_appended(m_published_serialization, *appended_from);
+    } else {
+        m_published_serialization = m_compilation_database->serialize();
+    }
+
+    const auto output = project_root() / compilation_database::database_name;
+    const auto &serialized = m_published_serialization;
+    logger_instance->log_info("Generated compilation database has " + std::to_string(serialized.size()) + " bytes");
+
+    if (m_change_detector.output_changed(output, serialized)) {
+        auto tmp_file = temporary_database_path();
+        bool written = compilation_database::write_serialized_to(tmp_file, serialized);
+
+        if (written) {
+            std::error_code ec;
+            fs::rename(tmp_file, output, ec);
+            written = !ec;
+        }
+
+        if (!written) {
+            logger_instance->log_error("Couldn't write the compilation database " + output.string());
+            return false;
+        }
+
+        m_change_detector.output_written(output, serialized);
+    } else {
+        logger_instance->log_info("The generated compilation database didn't change, skipping the write");
+    }
+
+    record_changes(appended_from);
+    return true;
+}
+
+void workspace::record_changes(std::optional<size_t> appended_from) {
+    if (!m_config.change_journal()) {
+        m_change_journal.reset();
+        return;
+    }
+
+    if (!m_change_journal) {
+        const auto path = project_root() / change_journal::journal_name;
+        m_change_detector.ignore_path(path);
+        m_change_detector.ignore_path(change_journal::compaction_path(path));
+        m_change_journal = change_journal::open(path);
+
+        if (!m_change_journal) {
+            logger::instance()->log_error("Couldn't open the change journal " + path.string());
+            return;
+        }
     }
 
+    if (!m_change_journal->record(m_compilation_database->database(), appended_from.value_or(0))) {
+        logger::instance()->log_error("Couldn't append to the change journal");
+        return;
+    }
+
+    logger::instance()->log_info("Journaled " + std::to_string(m_change_journal->num_recorded()) +
+                                 " changed files, up to sequence number " +
+                                 std::to_string(m_change_journal->sequence()));
+}
+
+config workspace::resolve_config(const fs::path &project_path, const std::optional<config> &conf) {
     std::optional<config> created_config{};
     if (conf) {
         created_config = conf.value();
@@ -301,13 +1461,19 @@ std::optional<workspace> workspace::discover_project(const fs::path &project_pat
         }
     }
 
-    if (!created_config) {
-        // Shouldn't happen
+    config resulting_config = created_config.value();
+    resulting_config.project_root(project_path);
+
+    return resulting_config;
+}
+
+std::optional<workspace> workspace::discover_project(const fs::path &project_path, const std::optional<config> &conf,
+                                                     const std::optional<fs::path> &config_path) {
+    if (!fs::exists(project_path) || !fs::is_directory(project_path)) {
         return std::nullopt;
     }
 
-    config resulting_config = created_config.value();
-    resulting_config.project_root(project_path);
+    config resulting_config = resolve_config(project_path, conf);
 
     int notify_fd = inotify_init1(IN_NONBLOCK);
     std::map<int, fs::path> directory_watches;
@@ -316,29 +1482,46 @@ std::optional<workspace> workspace::discover_project(const fs::path &project_pat
         return std::nullopt;
     }
 
-    for (auto &current_entry : fs::recursive_directory_iterator(project_path)) {
-        if (current_entry.is_directory() && is_relevant_file(current_entry, resulting_config)) {
-            auto absolute_path = fs::absolute(current_entry);
+    // Databases written by the sharded output can't be the input
+    const auto generated = generated_databases(fs::absolute(project_path));
+
+    batch_io io(resulting_config.io_uring_backend());
+
+    io.walk(project_path, [&](const std::string &path, bool is_directory, bool is_regular_file) {
+        if (!(is_directory || is_regular_file) || !is_relevant_file(path, resulting_config, is_regular_file)) {
+            return;
+        }
+
+        if (is_directory) {
+            auto absolute_path = fs::absolute(path);
             int watch_directory = inotify_add_watch(notify_fd, absolute_path.c_str(), IN_ALL_EVENTS);
 
             if (watch_directory != -1) {
                 std::cout << "Adding " << absolute_path.c_str() << " to the list of watched directories" << std::endl;
                 directory_watches.emplace(watch_directory, absolute_path);
             }
-        } else if (current_entry.is_regular_file() && is_relevant_file(current_entry, resulting_config)) {
-            if (current_entry.path().filename() == compilation_database::database_name) {
-                resulting_config.compilation_database_path(fs::absolute(current_entry.path()));
-                auto absolute_path = fs::absolute(current_entry);
-                int watch_compilation_database = inotify_add_watch(notify_fd, absolute_path.c_str(), IN_ALL_EVENTS);
-
-                if (watch_compilation_database != -1) {
-                    std::cout << "Adding compilation_database : " << absolute_path.c_str()
-                              << " to the list of watched things" << std::endl;
-                    directory_watches.emplace(watch_compilation_database, absolute_path);
-                }
+        } else if (filename_of(path) == compilation_database::database_name &&
+                   generated.count(fs::absolute(path)) == 0) {
+            auto absolute_path = fs::absolute(path);
+            resulting_config.compilation_database_path(absolute_path);
+            int watch_compilation_database = inotify_add_watch(notify_fd, absolute_path.c_str(), IN_ALL_EVENTS);
+
+            if (watch_compilation_database != -1) {
+                std::cout << "Adding compilation_database : " << absolute_path.c_str()
+                          << " to the list of watched things" << std::endl;
+                directory_watches.emplace(watch_compilation_database, absolute_path);
             }
         }
+    });
+
+    // A config which was passed in without its path can't be reloaded
+    std::optional<fs::path> watched_config;
+
+    if (config_path) {
+        watched_config = fs::absolute(*config_path);
+    } else if (!conf) {
+        watched_config = fs::absolute(project_path / "damnflags_conf.json");
     }
 
-    return workspace(std::move(notify_fd), std::move(directory_watches), resulting_config);
+    return workspace(std::move(notify_fd), std::move(directory_watches), resulting_config, std::move(watched_config));
 }
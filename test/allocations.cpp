@@ -0,0 +1,67 @@
+#include <cstdlib>
+#include <iostream>
+
+#include "allocation_counter.h"
+#include "compilation_database.h"
+#include "logger.h"
+#include "synthetic_project.h"
+
+// Counts the heap allocations of adding the missing headers to a database with allocation_counter, and fails if they
+// go over the bounds below. The temporaries of an update come from an arena, so what is left is mostly the created
+// entries themselves: the object, its three members and their strings.
+
+namespace {
+
+// Per added header, the entry alone takes about ten
+constexpr size_t max_allocations_per_header = 11;
+// The arenas, the workers and the log messages, independent of the size of the project
+constexpr size_t max_allocations_per_update = 64;
+
+bool check_project(size_t num_sources) {
+    auto project = synthetic_project::generate(synthetic_project_options{}
+                                                   .source_files(num_sources)
+                                                   .header_files(num_sources / 2)
+                                                   .unmatched_header_files(num_sources / 10)
+                                                   .directory_depth(3)
+                                                   .directories_per_level(4)
+                                                   .flag_variants(8));
+
+    if (!project) {
+        std::cerr << "Couldn't generate synthetic project with " << num_sources << " sources" << std::endl;
+        return false;
+    }
+
+    const auto original = compilation_database::read_from(project->compilation_database_path());
+    const auto relevant_files = project->relevant_files();
+    const auto conf = project->create_config();
+    const size_t num_headers = project->header_files().size();
+    const size_t bound = max_allocations_per_update + max_allocations_per_header * num_headers;
+
+    if (!original) {
+        std::cerr << "Couldn't read the database of the synthetic project" << std::endl;
+        return false;
+    }
+
+    // One thread, since every worker allocates its own state
+    auto database = *original;
+    allocation_counter counter;
+    database.add_missing_files(relevant_files, conf, augmentation_options{}.num_threads(1));
+    const size_t allocations = counter.allocations();
+
+    std::cout << num_sources << " sources, " << num_headers << " headers: " << allocations << " allocations, at most "
+              << bound << std::endl;
+
+    return allocations <= bound;
+}
+
+}  // namespace
+
+int main() {
+    // Created up front, so the logger itself isn't counted
+    logger::instance();
+
+    const bool small_project = check_project(200);
+    const bool large_project = check_project(2000);
+
+    return small_project && large_project ? EXIT_SUCCESS : EXIT_FAILURE;
+}
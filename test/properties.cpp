@@ -0,0 +1,237 @@
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory_resource>
+#include <numeric>
+#include <set>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <unistd.h>
+
+#include <nlohmann/json.hpp>
+
+#include "compilation_database.h"
+#include "random_inputs.h"
+#include "utils.h"
+
+// Checks the optimized implementations against simple references on random inputs. The references don't share any
+// code with what they check, they are written down from the documented behavior. The first mismatch of every check is
+// printed, and the exit code is non-zero if there was any.
+
+namespace {
+
+constexpr size_t num_commands = 10000;
+constexpr size_t num_patterns = 10000;
+constexpr size_t num_databases = 500;
+
+// The stream extraction of the standard library, which skips the same whitespace as std::isspace in the C locale
+std::vector<std::string> reference_split_command(const std::string &command_line) {
+    std::istringstream command_line_input(command_line);
+    std::vector<std::string> parts;
+
+    for (std::string current_part; command_line_input >> current_part;) {
+        parts.emplace_back(std::move(current_part));
+    }
+
+    return parts;
+}
+
+// Compares character by character at every position, the first match is replaced
+std::string reference_replace_pattern_with(const std::string &str, std::string_view to_replace,
+                                           std::string_view replace_with) {
+    for (size_t position = 0; !to_replace.empty() && position + to_replace.size() <= str.size(); ++position) {
+        size_t matched = 0;
+
+        while (matched < to_replace.size() && str[position + matched] == to_replace[matched]) {
+            ++matched;
+        }
+
+        if (matched == to_replace.size()) {
+            return str.substr(0, position).append(replace_with).append(str, position + to_replace.size());
+        }
+    }
+
+    return str;
+}
+
+// The options of GCC and Clang which take their value as the next argument
+const std::set<std::string_view> separate_value_options{
+    "-I", "-D", "-U", "-o", "-x",
+    "-isystem", "-iquote", "-idirafter", "-include", "-imacros", "-iprefix", "-iwithprefix", "-iwithprefixbefore",
+    "-isysroot", "-MF", "-MT", "-MQ", "-Xclang", "-Xlinker", "-Xassembler", "-Xpreprocessor",
+    "-target", "-arch", "--sysroot"};
+
+// Everything starting with these belongs to the file the command was for, the output or compiling only
+const std::vector<std::string_view> dropped_prefixes{"-o", "-c"};
+
+// The compiler stays, every other option is kept or dropped together with its separate value, and whatever doesn't
+// start with a dash isn't an option at all
+std::vector<std::string_view> reference_remove_specific_flags(const std::vector<std::string_view> &command) {
+    if (command.empty()) {
+        return {};
+    }
+
+    std::vector<std::string_view> kept{command.front()};
+
+    for (size_t i = 1; i < command.size();) {
+        const auto option = command[i];
+        const size_t unit_size = separate_value_options.count(option) != 0 && i + 1 < command.size() ? 2 : 1;
+        bool dropped = option.empty() || option.front() != '-';
+
+        for (const auto prefix : dropped_prefixes) {
+            dropped = dropped || option.substr(0, prefix.size()) == prefix;
+        }
+
+        if (!dropped) {
+            kept.insert(kept.end(), command.begin() + i, command.begin() + i + unit_size);
+        }
+
+        i += unit_size;
+    }
+
+    return kept;
+}
+
+template<typename Container>
+std::string joined(const Container &parts) {
+    std::string result;
+
+    for (const auto &current_part : parts) {
+        result += "[" + std::string(current_part) + "]";
+    }
+
+    return result;
+}
+
+bool report_mismatch(const std::string &what, const std::string &input, const std::string &expected,
+                     const std::string &actual) {
+    std::cerr << what << " differs from the reference\n  input:     " << input << "\n  reference: " << expected
+              << "\n  actual:    " << actual << std::endl;
+    return false;
+}
+
+bool check_split_command() {
+    auto engine = random_engine();
+    std::pmr::monotonic_buffer_resource arena;
+
+    for (size_t i = 0; i < num_commands; ++i) {
+        const auto command = random_command(engine);
+        std::pmr::vector<std::string_view> parts(&arena);
+        split_command(command, parts);
+        const auto expected = reference_split_command(command);
+
+        if (!std::equal(parts.cbegin(), parts.cend(), expected.cbegin(), expected.cend())) {
+            return report_mismatch("split_command", command, joined(expected), joined(parts));
+        }
+
+        if (const auto copied = split_command(command); copied != expected) {
+            return report_mismatch("split_command (copying)", command, joined(expected), joined(copied));
+        }
+    }
+
+    return true;
+}
+
+bool check_remove_specific_flags() {
+    auto engine = random_engine();
+    std::pmr::monotonic_buffer_resource arena;
+
+    for (size_t i = 0; i < num_commands; ++i) {
+        const auto command = random_command(engine);
+        std::pmr::vector<std::string_view> parts(&arena);
+        split_command(command, parts);
+
+        auto filtered = parts;
+        remove_specific_flags(filtered);
+        const auto expected = reference_remove_specific_flags({parts.cbegin(), parts.cend()});
+
+        if (!std::equal(filtered.cbegin(), filtered.cend(), expected.cbegin(), expected.cend())) {
+            return report_mismatch("remove_specific_flags", joined(parts), joined(expected), joined(filtered));
+        }
+    }
+
+    return true;
+}
+
+bool check_replace_pattern_with() {
+    auto engine = random_engine();
+
+    for (size_t i = 0; i < num_patterns; ++i) {
+        const auto [pattern, to_replace] = random_pattern(engine);
+        auto replaced = pattern;
+        replace_pattern_with(replaced, to_replace, "/root");
+        const auto expected = reference_replace_pattern_with(pattern, to_replace, "/root");
+
+        if (replaced != expected) {
+            return report_mismatch("replace_pattern_with", pattern + " with " + std::string(to_replace), expected,
+                                   replaced);
+        }
+    }
+
+    return true;
+}
+
+// Reading has to give the same document as parsing, and every way to serialize has to give it back
+bool check_database_round_trip() {
+    auto engine = random_engine();
+    const auto path = fs::temp_directory_path() / ("damnflags_property_" + std::to_string(getpid()) + ".json");
+    const auto read_database = [&path](const std::string &content) {
+        std::ofstream(path, std::ios::binary) << content;
+        return compilation_database::read_from(path);
+    };
+    bool agrees = true;
+
+    for (size_t i = 0; agrees && i < num_databases; ++i) {
+        const auto expected = random_database(engine);
+        const auto input = expected.dump(i % 2 == 0 ? -1 : 4);
+        auto database = read_database(input);
+
+        if (!database || database->database() != expected) {
+            agrees = report_mismatch("read_from", input, expected.dump(), database ? database->database().dump() : "");
+            continue;
+        }
+
+        const auto serialized = database->serialize();
+        std::vector<size_t> all_entries(expected.size());
+        std::iota(all_entries.begin(), all_entries.end(), 0);
+
+        if (nlohmann::json::parse(serialized, nullptr, false) != expected) {
+            agrees = report_mismatch("serialize", input, expected.dump(), serialized);
+            continue;
+        }
+
+        if (const auto selected = database->serialize_entries(all_entries); selected != serialized) {
+            agrees = report_mismatch("serialize_entries", input, serialized, selected);
+            continue;
+        }
+
+        // Spliced onto what the first half of the entries serialized to
+        auto first_half = expected;
+        first_half.erase(first_half.begin() + expected.size() / 2, first_half.end());
+        auto spliced = read_database(first_half.dump())->serialize();
+        database->serialize_appended(spliced, expected.size() / 2);
+
+        if (spliced != serialized) {
+            agrees = report_mismatch("serialize_appended", input, serialized, spliced);
+        }
+    }
+
+    fs::remove(path);
+    return agrees;
+}
+
+}  // namespace
+
+int main() {
+    // Every check runs, so one run shows all of the functions which disagree
+    const bool checks[] = {check_split_command(), check_remove_specific_flags(), check_replace_pattern_with(),
+                           check_database_round_trip()};
+
+    return std::all_of(std::begin(checks), std::end(checks), [](bool agrees) { return agrees; }) ? EXIT_SUCCESS
+                                                                                               : EXIT_FAILURE;
+}